@@ -38,6 +38,7 @@ testScriptsExt=(
     'bipdersig.py'
     'getblocktemplate_longpoll.py'
     'getblocktemplate_proposals.py'
+    'getblocktemplate_cache.py'
     'pruning.py'
     'forknotify.py'
     'invalidateblock.py'
@@ -0,0 +1,95 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that repeated getblocktemplate calls are answered from the cached
+# template while the tip and the mempool stay the same, and that the cache
+# does not hold back a new template after either changed.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import threading
+import time
+
+class LongpollThread(threading.Thread):
+    def __init__(self, node, longpollid):
+        threading.Thread.__init__(self)
+        self.longpollid = longpollid
+        # create a new connection to the node, we can't use the same
+        # connection from two threads
+        self.node = AuthServiceProxy(node.url, timeout=600)
+        self.result = None
+
+    def run(self):
+        self.result = self.node.getblocktemplate({'longpollid':self.longpollid})
+
+def tx_hashes(templat):
+    return [tx['hash'] for tx in templat['transactions']]
+
+class GetBlockTemplateCacheTest(BitcoinTestFramework):
+    '''
+    Test the getblocktemplate cache.
+    '''
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(1)
+        self.sync_all()
+        now = int(time.time())
+        node.setmocktime(now)
+
+        # Repeat requests get the same template
+        templat = node.getblocktemplate()
+        templat2 = node.getblocktemplate()
+        assert_equal(templat2['longpollid'], templat['longpollid'])
+        assert_equal(templat2['previousblockhash'], templat['previousblockhash'])
+        assert_equal(tx_hashes(templat2), tx_hashes(templat))
+
+        # The requested capabilities do not change the template
+        templat2 = node.getblocktemplate({'capabilities':['coinbasetxn', 'workid']})
+        assert_equal(templat2['longpollid'], templat['longpollid'])
+
+        # A cached template still gets the current time
+        node.setmocktime(now + 3)
+        templat2 = node.getblocktemplate()
+        assert_equal(templat2['longpollid'], templat['longpollid'])
+        assert_equal(templat2['curtime'], now + 3)
+
+        # A template is reused for five seconds after the mempool changed...
+        txid = node.sendtoaddress(self.nodes[1].getnewaddress(), 1)
+        templat2 = node.getblocktemplate()
+        assert_equal(templat2['longpollid'], templat['longpollid'])
+        assert(txid not in tx_hashes(templat2))
+
+        # ...and rebuilt after that
+        node.setmocktime(now + 10)
+        templat2 = node.getblocktemplate()
+        assert(templat2['longpollid'] != templat['longpollid'])
+        assert(txid in tx_hashes(templat2))
+        assert_equal(templat2['curtime'], now + 10)
+
+        # A new tip is seen right away
+        node.generate(1)
+        templat3 = node.getblocktemplate()
+        assert_equal(templat3['previousblockhash'], node.getbestblockhash())
+        assert(txid not in tx_hashes(templat3))
+        node.setmocktime(0)
+        self.sync_all()
+
+        # A longpoll returns a template on top of the block that woke it up
+        thr = LongpollThread(node, templat3['longpollid'])
+        thr.start()
+        thr.join(5)
+        assert(thr.is_alive())
+        self.nodes[1].generate(1)
+        thr.join(5)
+        assert(not thr.is_alive())
+        assert_equal(thr.result['previousblockhash'], self.nodes[1].getbestblockhash())
+        assert_equal(node.getblocktemplate()['longpollid'], thr.result['longpollid'])
+
+if __name__ == '__main__':
+    GetBlockTemplateCacheTest().main()
@@ -0,0 +1,35 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "base58.h"
+
+#include <vector>
+
+static void Base58Encode(benchmark::State& state)
+{
+    const std::vector<unsigned char> vch(32, 0x5a);
+    while (state.KeepRunning())
+        EncodeBase58(vch);
+}
+
+static void Base58CheckEncode(benchmark::State& state)
+{
+    const std::vector<unsigned char> vch(21, 0x5a);
+    while (state.KeepRunning())
+        EncodeBase58Check(vch);
+}
+
+static void Base58Decode(benchmark::State& state)
+{
+    const std::string str = EncodeBase58Check(std::vector<unsigned char>(21, 0x5a));
+    std::vector<unsigned char> vch;
+    while (state.KeepRunning())
+        DecodeBase58(str, vch);
+}
+
+BENCHMARK(Base58Encode);
+BENCHMARK(Base58CheckEncode);
+BENCHMARK(Base58Decode);
@@ -0,0 +1,73 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "utiltime.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace benchmark {
+
+/** Samples shorter than this are not trusted; the iteration count is doubled instead. */
+static const int64_t MIN_SAMPLE_MICROS = 5000;
+/** Minimum number of samples taken, however long a benchmark runs. */
+static const size_t MIN_SAMPLES = 5;
+
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+BenchRunner::BenchRunner(const std::string& name, BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+void BenchRunner::RunAll(const std::string& strFilter, int64_t nMaxElapsed)
+{
+    printf("# Benchmark, samples, iterations, min ns/op, median ns/op, max ns/op\n");
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it) {
+        if (it->first.find(strFilter) == std::string::npos)
+            continue;
+        State state(it->first, nMaxElapsed);
+        it->second(state);
+    }
+}
+
+State::State(const std::string& nameIn, int64_t nMaxElapsedIn) :
+    name(nameIn), nMaxElapsed(nMaxElapsedIn), nSampleIters(1), nIter(0), nTotalIters(0)
+{
+    nBeginTime = nSampleBegin = GetTimeMicros();
+}
+
+bool State::NextSample()
+{
+    int64_t nNow = GetTimeMicros();
+    int64_t nElapsed = nNow - nSampleBegin;
+    nIter = 0;
+
+    if (nElapsed < MIN_SAMPLE_MICROS) {
+        // Too short to time reliably; run more iterations per sample.
+        nSampleIters *= 2;
+        nSampleBegin = GetTimeMicros();
+        return true;
+    }
+
+    vSamples.push_back(nElapsed * 1000.0 / nSampleIters);
+    nTotalIters += nSampleIters;
+    if (nNow - nBeginTime < nMaxElapsed || vSamples.size() < MIN_SAMPLES) {
+        nSampleBegin = GetTimeMicros();
+        return true;
+    }
+
+    std::sort(vSamples.begin(), vSamples.end());
+    printf("%s, %u, %llu, %.1f, %.1f, %.1f\n", name.c_str(), (unsigned int)vSamples.size(), (unsigned long long)nTotalIters,
+           vSamples.front(), vSamples[vSamples.size() / 2], vSamples.back());
+    return false;
+}
+
+} // namespace benchmark
@@ -0,0 +1,83 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+/**
+ * Usage:
+ *
+ * static void CODE_TO_TIME(benchmark::State& state)
+ * {
+ *     ... do any setup needed...
+ *     while (state.KeepRunning()) {
+ *         ... do stuff you want to time...
+ *     }
+ *     ... do any cleanup needed...
+ * }
+ *
+ * BENCHMARK(CODE_TO_TIME);
+ */
+
+namespace benchmark {
+
+/**
+ * Drives the timing loop of one benchmark. Iterations are timed in samples
+ * long enough for the clock resolution not to matter, and the spread of the
+ * per-sample cost is reported as min/median/max nanoseconds per operation.
+ */
+class State
+{
+private:
+    std::string name;
+    int64_t nMaxElapsed;
+    int64_t nBeginTime;
+    int64_t nSampleBegin;
+    uint64_t nSampleIters;
+    uint64_t nIter;
+    uint64_t nTotalIters;
+    std::vector<double> vSamples;
+
+    bool NextSample();
+
+public:
+    State(const std::string& nameIn, int64_t nMaxElapsedIn);
+
+    bool KeepRunning()
+    {
+        if (++nIter < nSampleIters)
+            return true;
+        return NextSample();
+    }
+};
+
+typedef void (*BenchFunction)(State&);
+
+class BenchRunner
+{
+    typedef std::map<std::string, BenchFunction> BenchmarkMap;
+    static BenchmarkMap& benchmarks();
+
+public:
+    BenchRunner(const std::string& name, BenchFunction func);
+
+    /** Run every benchmark whose name contains strFilter, each for about nMaxElapsed microseconds. */
+    static void RunAll(const std::string& strFilter, int64_t nMaxElapsed);
+};
+
+} // namespace benchmark
+
+// BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCOIN_BENCH_BENCH_H
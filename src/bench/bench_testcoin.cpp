@@ -0,0 +1,51 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/hashskein.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "main.h"
+#include "pubkey.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        printf("Usage: bench_testcoin [-filter=<substring>] [-time=<ms>] [-par=<n>]\n");
+        return 0;
+    }
+
+    ECC_Start();
+    ECCVerifyHandle globalVerifyHandle;
+    SHA256AutoDetect();
+    SkeinAutoDetect();
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::REGTEST);
+
+    // Worker threads for the benchmarks of parallel checks, sized as in AppInit2.
+    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread(&ThreadScriptCheck);
+
+    benchmark::BenchRunner::RunAll(GetArg("-filter", ""), GetArg("-time", 1000) * 1000);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    ECC_Stop();
+    return 0;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "version.h"
+
+/** A block of 2000 distinct one-input, two-output transactions. */
+static CBlock CreateBlock()
+{
+    CBlock block = Params().GenesisBlock();
+    block.vtx.resize(2000);
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(block.hashPrevBlock, i);
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+        tx.vout.resize(2);
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            tx.vout[j].nValue = 1000 * i + j;
+            tx.vout[j].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, j) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx[i] = tx;
+    }
+    return block;
+}
+
+static void BuildMerkleTree(benchmark::State& state)
+{
+    CBlock block = CreateBlock();
+    while (state.KeepRunning())
+        block.BuildMerkleTree();
+}
+
+static void SerializeBlock(benchmark::State& state)
+{
+    CBlock block = CreateBlock();
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream.reserve(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    while (state.KeepRunning()) {
+        stream.clear();
+        stream << block;
+    }
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CreateBlock();
+    const std::vector<char> vData(stream.begin(), stream.end());
+    while (state.KeepRunning()) {
+        CDataStream ssBlock(vData, SER_NETWORK, PROTOCOL_VERSION);
+        CBlock block;
+        ssBlock >> block;
+    }
+}
+
+BENCHMARK(BuildMerkleTree);
+BENCHMARK(SerializeBlock);
+BENCHMARK(DeserializeBlock);
@@ -0,0 +1,63 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "pow.h"
+
+#include <assert.h>
+
+/** A full headers message worth of chained regtest headers, each with valid proof of work. */
+static const std::vector<CBlockHeader>& HeadersMessage()
+{
+    static std::vector<CBlockHeader> headers;
+    if (headers.empty()) {
+        const CBlockHeader& genesis = Params().GenesisBlock();
+        headers.resize(MAX_HEADERS_RESULTS);
+        for (size_t i = 0; i < headers.size(); i++) {
+            CBlockHeader& header = headers[i];
+            header.nVersion = genesis.nVersion;
+            header.hashPrevBlock = i ? headers[i - 1].GetHash() : genesis.GetHash();
+            header.hashMerkleRoot = ArithToUint256(arith_uint256(i));
+            header.nTime = genesis.nTime + 60 * (i + 1);
+            header.nBits = genesis.nBits;
+            header.nNonce = 0;
+            while (!CheckProofOfWork(header.GetPoWHash(), header.nBits, Params().GetConsensus()))
+                header.nNonce++;
+        }
+    }
+    return headers;
+}
+
+static void CheckHeaders(benchmark::State& state, int nThreads)
+{
+    const std::vector<CBlockHeader>& headers = HeadersMessage();
+    int nThreadsSaved = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads;
+    while (state.KeepRunning()) {
+        CValidationState validationState;
+        bool fOk = CheckBlockHeadersPoW(headers, validationState);
+        assert(fOk);
+    }
+    nScriptCheckThreads = nThreadsSaved;
+}
+
+// Check the proof of work of a 2000-header message on the calling thread only.
+static void CheckBlockHeadersPoW_Serial(benchmark::State& state)
+{
+    CheckHeaders(state, 0);
+}
+
+// Same, spread over the header check threads (see -par).
+static void CheckBlockHeadersPoW_Parallel(benchmark::State& state)
+{
+    CheckHeaders(state, nScriptCheckThreads);
+}
+
+BENCHMARK(CheckBlockHeadersPoW_Serial);
+BENCHMARK(CheckBlockHeadersPoW_Parallel);
@@ -0,0 +1,75 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "coins.h"
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "utilstrencodings.h"
+
+#include <assert.h>
+
+/** Number of transactions whose coins each iteration touches. */
+static const unsigned int COINS_BENCH_COUNT = 1000;
+
+/** Number of outputs of each of those transactions. */
+static const unsigned int COINS_BENCH_OUTPUTS = 2;
+
+static Coin CreateCoin(unsigned int n)
+{
+    CTxOut out;
+    out.nValue = 50000;
+    out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, n) << OP_EQUALVERIFY << OP_CHECKSIG;
+    return Coin(out, 1, false, 1);
+}
+
+static std::vector<COutPoint> CreateOutPoints()
+{
+    std::vector<COutPoint> vOutPoints;
+    for (unsigned int i = 0; i < COINS_BENCH_COUNT; i++) {
+        uint256 txid = Hash(BEGIN(i), END(i));
+        for (unsigned int n = 0; n < COINS_BENCH_OUTPUTS; n++)
+            vOutPoints.push_back(COutPoint(txid, n));
+    }
+    return vOutPoints;
+}
+
+// Fetch coins into an empty cache from the cache below it, as pcoinsTip does from the database cache.
+static void CoinsCacheFetch(benchmark::State& state)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache base(&viewDummy);
+    const std::vector<COutPoint> vOutPoints = CreateOutPoints();
+    for (unsigned int i = 0; i < vOutPoints.size(); i++)
+        base.AddCoin(vOutPoints[i], CreateCoin(vOutPoints[i].n), false);
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&base);
+        for (unsigned int i = 0; i < vOutPoints.size(); i++) {
+            const Coin& coin = cache.AccessCoin(vOutPoints[i]);
+            assert(!coin.IsSpent());
+        }
+    }
+}
+
+// Create coins in a cache and flush them into the cache below it.
+static void CoinsCacheFlush(benchmark::State& state)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache base(&viewDummy);
+    const std::vector<COutPoint> vOutPoints = CreateOutPoints();
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&base);
+        for (unsigned int i = 0; i < vOutPoints.size(); i++)
+            cache.AddCoin(vOutPoints[i], CreateCoin(vOutPoints[i].n), true);
+        bool fFlushed = cache.Flush();
+        assert(fFlushed);
+    }
+}
+
+BENCHMARK(CoinsCacheFetch);
+BENCHMARK(CoinsCacheFlush);
@@ -0,0 +1,44 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/sha256.h"
+#include "primitives/block.h"
+#include "serialize.h"
+
+#include <vector>
+
+// One megabyte through the streaming SHA256 interface.
+static void SHA256_1M(benchmark::State& state)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    std::vector<unsigned char> in(1000 * 1000, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(begin_ptr(in), in.size()).Finalize(hash);
+}
+
+// Double-SHA256 of 64-byte inputs, as used for merkle tree levels.
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<unsigned char> in(64 * 1024, 0);
+    std::vector<unsigned char> out(32 * 1024);
+    while (state.KeepRunning())
+        SHA256D64(begin_ptr(out), begin_ptr(in), 1024);
+}
+
+// Skein-512 + SHA256 proof-of-work hash of one block header.
+static void GetPoWHash(benchmark::State& state)
+{
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        header.GetPoWHash();
+    }
+}
+
+BENCHMARK(SHA256_1M);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(GetPoWHash);
@@ -0,0 +1,41 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "txmempool.h"
+#include "utilstrencodings.h"
+
+#include <list>
+
+// Add 1000 independent transactions to a mempool and remove them again.
+static void MempoolAddRemove(benchmark::State& state)
+{
+    std::vector<CTransaction> vtx;
+    for (unsigned int i = 0; i < 1000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(Hash(BEGIN(i), END(i)), 0);
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 10000;
+        tx.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+        vtx.push_back(tx);
+    }
+
+    CTxMemPool pool(CFeeRate(0));
+    std::list<CTransaction> removed;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vtx.size(); i++)
+            pool.addUnchecked(vtx[i].GetHash(), CTxMemPoolEntry(vtx[i], 1000, 0, 0.0, 1));
+        for (size_t i = 0; i < vtx.size(); i++)
+            pool.remove(vtx[i], removed);
+        removed.clear();
+    }
+}
+
+BENCHMARK(MempoolAddRemove);
@@ -0,0 +1,72 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "hash.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "utilstrencodings.h"
+
+#include <assert.h>
+
+static void VerifySignature(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CPubKey pubkey = key.GetPubKey();
+    const uint256 hash = Hash(pubkey.begin(), pubkey.end());
+    std::vector<unsigned char> vchSig;
+    bool fSigned = key.Sign(hash, vchSig);
+    assert(fSigned);
+    while (state.KeepRunning()) {
+        bool fValid = pubkey.Verify(hash, vchSig);
+        assert(fValid);
+    }
+}
+
+/** A transaction spending 100 pay-to-pubkey-hash outputs. */
+static CTransaction CreateSpend(CScript& scriptCode)
+{
+    scriptCode = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CMutableTransaction tx;
+    tx.vin.resize(100);
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout = COutPoint(Hash(BEGIN(i), END(i)), 0);
+        tx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+    }
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = tx.vout[1].scriptPubKey = scriptCode;
+    return tx;
+}
+
+// Signature hashes of every input of a 100-input transaction.
+static void SignatureHash_100(benchmark::State& state)
+{
+    CScript scriptCode;
+    const CTransaction tx = CreateSpend(scriptCode);
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            SignatureHash(scriptCode, tx, i, SIGHASH_ALL);
+    }
+}
+
+// Same, with the transaction data precomputed once per transaction.
+static void SignatureHash_100_Precomputed(benchmark::State& state)
+{
+    CScript scriptCode;
+    const CTransaction tx = CreateSpend(scriptCode);
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            SignatureHash(scriptCode, tx, i, SIGHASH_ALL, &txdata);
+    }
+}
+
+BENCHMARK(VerifySignature);
+BENCHMARK(SignatureHash_100);
+BENCHMARK(SignatureHash_100_Precomputed);
@@ -0,0 +1,288 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstorage.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+#include "sync.h"
+#include "util.h"
+#include "version.h"
+
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+void CBlockReadAhead::Thread()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nThreads++;
+    try {
+        while (true) {
+            while (queueJobs.empty())
+                condWorker.wait(lock);
+            uint256 hash = queueJobs.front();
+            queueJobs.pop_front();
+            std::map<uint256, CReadJob>::iterator it = mapJobs.find(hash);
+            if (it == mapJobs.end() || it->second.fStarted)
+                continue;
+            it->second.fStarted = true;
+            CDiskBlockPos pos = it->second.pos;
+            lock.unlock();
+
+            boost::shared_ptr<CBlock> pblock(new CBlock());
+            if (!ReadBlockFromDisk(*pblock, pos) || pblock->GetHash() != hash)
+                pblock.reset();
+
+            lock.lock();
+            // The job may have been dropped and requested again meanwhile;
+            // whichever instance is there now gets the result.
+            it = mapJobs.find(hash);
+            if (it != mapJobs.end() && !it->second.fDone) {
+                it->second.fStarted = true;
+                it->second.fDone = true;
+                it->second.pblock = pblock;
+            }
+            condDone.notify_all();
+        }
+    } catch (...) {
+        // The exception may have come from the unlocked block read.
+        if (!lock.owns_lock())
+            lock.lock();
+        nThreads--;
+        throw;
+    }
+}
+
+void CBlockReadAhead::Request(const std::vector<const CBlockIndex*>& vpindex)
+{
+    AssertLockHeld(cs_main);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    std::set<uint256> setWanted;
+    if (nThreads > 0) {
+        BOOST_FOREACH(const CBlockIndex* pindex, vpindex)
+            setWanted.insert(pindex->GetBlockHash());
+    }
+    for (std::map<uint256, CReadJob>::iterator it = mapJobs.begin(); it != mapJobs.end(); ) {
+        if (!setWanted.count(it->first) && (!it->second.fStarted || it->second.fDone))
+            mapJobs.erase(it++);
+        else
+            it++;
+    }
+    if (setWanted.empty())
+        return;
+
+    queueJobs.clear();
+    BOOST_FOREACH(const CBlockIndex* pindex, vpindex) {
+        std::pair<std::map<uint256, CReadJob>::iterator, bool> ret = mapJobs.insert(std::make_pair(pindex->GetBlockHash(), CReadJob()));
+        if (ret.second)
+            ret.first->second.pos = pindex->GetBlockPos();
+        if (!ret.first->second.fStarted)
+            queueJobs.push_back(pindex->GetBlockHash());
+    }
+    condWorker.notify_all();
+}
+
+boost::shared_ptr<CBlock> CBlockReadAhead::Read(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<uint256, CReadJob>::iterator it = mapJobs.find(pindex->GetBlockHash());
+        if (it != mapJobs.end()) {
+            // Wait for a read that is under way rather than doing it twice.
+            while (it->second.fStarted && !it->second.fDone)
+                condDone.wait(lock);
+            boost::shared_ptr<CBlock> pblock = it->second.pblock;
+            mapJobs.erase(it);
+            if (pblock)
+                return pblock;
+            // Not started yet, or it failed: read it here, which also
+            // reports a failure properly.
+        }
+    }
+    boost::shared_ptr<CBlock> pblock(new CBlock());
+    if (!ReadBlockFromDisk(*pblock, pindex))
+        pblock.reset();
+    return pblock;
+}
+
+bool CBlockReadAhead::IsReady(const uint256& hash)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    std::map<uint256, CReadJob>::const_iterator it = mapJobs.find(hash);
+    return it != mapJobs.end() && it->second.fDone && it->second.pblock;
+}
+
+CRecentBlocks::CEntry* CRecentBlocks::Find(const uint256& hash)
+{
+    for (std::deque<CEntry>::iterator it = entries.begin(); it != entries.end(); it++) {
+        if (it->hash == hash)
+            return &*it;
+    }
+    return NULL;
+}
+
+void CRecentBlocks::Add(const boost::shared_ptr<const CBlock>& pblock)
+{
+    AssertLockHeld(cs_main);
+    uint256 hash = pblock->GetHash();
+    if (Find(hash))
+        return;
+    entries.push_back(CEntry());
+    entries.back().hash = hash;
+    entries.back().pblock = pblock;
+    if (entries.size() > RECENT_BLOCKS_SIZE)
+        entries.pop_front();
+}
+
+boost::shared_ptr<const CBlock> CRecentBlocks::Get(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    CEntry* pentry = Find(hash);
+    return pentry ? pentry->pblock : boost::shared_ptr<const CBlock>();
+}
+
+boost::shared_ptr<const std::vector<char> > CRecentBlocks::GetSerialized(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    CEntry* pentry = Find(hash);
+    if (!pentry)
+        return boost::shared_ptr<const std::vector<char> >();
+    if (!pentry->pvchBlock) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss.reserve(::GetSerializeSize(*pentry->pblock, SER_NETWORK, PROTOCOL_VERSION));
+        ss << *pentry->pblock;
+        pentry->pvchBlock.reset(new std::vector<char>(ss.begin(), ss.end()));
+    }
+    return pentry->pvchBlock;
+}
+
+void ScanBlockFile(FILE* fileIn, const CDiskBlockPos* dbp, const ScannedBlockFunc& found)
+{
+    CDiskBlockPos pos;
+    if (dbp)
+        pos = *dbp;
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        boost::this_thread::interruption_point();
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(Params().MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block
+            uint64_t nBlockPos = blkdat.GetPos();
+            pos.nPos = nBlockPos;
+            blkdat.SetLimit(nBlockPos + nSize);
+            blkdat.SetPos(nBlockPos);
+            boost::shared_ptr<CBlock> pblock(new CBlock());
+            blkdat >> *pblock;
+            nRewind = blkdat.GetPos();
+
+            if (!found(pblock, pblock->GetHash(), dbp ? &pos : NULL, nSize))
+                break;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+}
+
+bool CReindexScanner::Found(int nFile, const boost::shared_ptr<CBlock>& pblock, const uint256& hash, CDiskBlockPos* dbp, unsigned int nSize)
+{
+    CScannedBlock scanned;
+    scanned.pblock = pblock;
+    scanned.hash = hash;
+    scanned.pos = *dbp;
+    scanned.nSize = nSize;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    CFileQueue& file = vFiles[nFile];
+    while (!fStop && file.nBytes >= REINDEX_SCAN_BUFFER_SIZE)
+        condScanner.wait(lock);
+    if (fStop)
+        return false;
+    file.blocks.push_back(scanned);
+    file.nBytes += scanned.nSize;
+    if (nFile == nImportFile)
+        condImporter.notify_one();
+    return true;
+}
+
+void CReindexScanner::Thread()
+{
+    RenameThread("bitcoin-reindex");
+    while (true) {
+        int nFile;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && nNextFile < (int)vFiles.size() && nNextFile > nImportFile + nFilesAhead)
+                condScanner.wait(lock);
+            if (fStop || nNextFile >= (int)vFiles.size())
+                return;
+            nFile = nNextFile++;
+        }
+        CDiskBlockPos pos(nFile, 0);
+        FILE* fileIn = OpenBlockFile(pos, true);
+        if (fileIn) {
+            try {
+                ScanBlockFile(fileIn, &pos, boost::bind(&CReindexScanner::Found, this, nFile, _1, _2, _3, _4));
+            } catch (const std::runtime_error& e) {
+                LogPrintf("%s: Error scanning block file %s - %s\n", __func__, pos.ToString(), e.what());
+            }
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vFiles[nFile].fDone = true;
+        condImporter.notify_one();
+    }
+}
+
+bool CReindexScanner::Next(int nFile, CScannedBlock& scanned)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (nImportFile != nFile) {
+        nImportFile = nFile;
+        condScanner.notify_all();
+    }
+    CFileQueue& file = vFiles[nFile];
+    while (file.blocks.empty() && !file.fDone)
+        condImporter.wait(lock);
+    if (file.blocks.empty())
+        return false;
+    scanned = file.blocks.front();
+    file.blocks.pop_front();
+    file.nBytes -= scanned.nSize;
+    condScanner.notify_all();
+    return true;
+}
+
+void CReindexScanner::Stop()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fStop = true;
+    condScanner.notify_all();
+}
@@ -0,0 +1,186 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKSTORAGE_H
+#define BITCOIN_BLOCKSTORAGE_H
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Reads the blocks ActivateBestChain is about to connect from disk on
+ * background threads, so that reading and deserializing the next blocks
+ * overlaps with connecting the current one. Blocks are still connected one
+ * at a time and in order; this only changes where their bytes come from.
+ */
+class CBlockReadAhead
+{
+private:
+    struct CReadJob
+    {
+        CDiskBlockPos pos;
+        bool fStarted;
+        bool fDone;
+        boost::shared_ptr<CBlock> pblock; //!< NULL if the read failed
+
+        CReadJob() : fStarted(false), fDone(false) {}
+    };
+
+    boost::mutex mutex;
+    //! Worker threads wait on this for jobs to be queued.
+    boost::condition_variable condWorker;
+    //! Read() waits on this for a started job to finish.
+    boost::condition_variable condDone;
+    //! Requested blocks by hash. Finished ones stay until taken or no longer wanted.
+    std::map<uint256, CReadJob> mapJobs;
+    //! Hashes of the jobs no worker has started yet, in connection order.
+    std::deque<uint256> queueJobs;
+    //! Number of worker threads. Without any, nothing is read ahead.
+    int nThreads;
+
+public:
+    CBlockReadAhead() : nThreads(0) {}
+
+    //! Worker thread loop.
+    void Thread();
+
+    /**
+     * Set the blocks to read ahead, in the order they will be connected.
+     * Jobs for any other blocks are dropped, unless a worker is busy with one.
+     * Must be called by the thread connecting blocks (with cs_main held).
+     */
+    void Request(const std::vector<const CBlockIndex*>& vpindex);
+
+    /**
+     * Get a block: the result of its read ahead if it was requested, or else
+     * read from disk right now. Returns NULL if it cannot be read.
+     */
+    boost::shared_ptr<CBlock> Read(const CBlockIndex* pindex);
+
+    //! Whether a block has been read ahead and is waiting to be taken by Read().
+    bool IsReady(const uint256& hash);
+};
+
+/** Number of most recently connected blocks kept in memory for serving them to peers. */
+static const size_t RECENT_BLOCKS_SIZE = 8;
+
+/**
+ * The blocks connected last, kept in memory so that a new block being
+ * requested by many peers is not read from disk again for each of them, and
+ * serialized only once. Protected by cs_main.
+ */
+class CRecentBlocks
+{
+private:
+    struct CEntry
+    {
+        uint256 hash;
+        boost::shared_ptr<const CBlock> pblock;
+        //! The serialized block, made when it is first asked for.
+        boost::shared_ptr<const std::vector<char> > pvchBlock;
+    };
+
+    //! Most recent last.
+    std::deque<CEntry> entries;
+
+    CEntry* Find(const uint256& hash);
+
+public:
+    void Add(const boost::shared_ptr<const CBlock>& pblock);
+
+    //! The block with this hash, or NULL if it isn't one of the recent ones.
+    boost::shared_ptr<const CBlock> Get(const uint256& hash);
+
+    //! The serialized block with this hash, or NULL if it isn't one of the recent ones.
+    boost::shared_ptr<const std::vector<char> > GetSerialized(const uint256& hash);
+};
+
+/**
+ * Called by ScanBlockFile for every block found, with the size of the block
+ * as recorded in the file; returning false stops the scan.
+ */
+typedef boost::function<bool (const boost::shared_ptr<CBlock>& pblock, const uint256& hash, CDiskBlockPos* dbp, unsigned int nSize)> ScannedBlockFunc;
+
+/**
+ * Locate the blocks in a file of serialized blocks, each preceded by the
+ * message start and its size (like blk?????.dat), deserialize and hash them,
+ * and pass them to found in file order. If dbp is given it is the position of
+ * the file, and the blocks are passed with their position in it.
+ * This takes over fileIn and closes it.
+ */
+void ScanBlockFile(FILE* fileIn, const CDiskBlockPos* dbp, const ScannedBlockFunc& found);
+
+/** Amount of deserialized blocks each -reindex scanning thread may buffer for the importer. */
+static const size_t REINDEX_SCAN_BUFFER_SIZE = 32 * 1000 * 1000;
+
+/**
+ * Scans the block files for -reindex on several threads, each working on a
+ * different file, and hands the blocks found to the importing thread one file
+ * after the other, in file order. So searching for blocks, deserializing and
+ * hashing them happen in parallel, while blocks are imported in exactly the
+ * order a single threaded reindex would import them.
+ */
+class CReindexScanner
+{
+public:
+    struct CScannedBlock
+    {
+        boost::shared_ptr<CBlock> pblock;
+        uint256 hash;
+        CDiskBlockPos pos;
+        size_t nSize;
+    };
+
+private:
+    struct CFileQueue
+    {
+        std::deque<CScannedBlock> blocks;
+        size_t nBytes;  //!< serialized size of the blocks queued
+        bool fDone;     //!< the scan of this file has finished
+
+        CFileQueue() : nBytes(0), fDone(false) {}
+    };
+
+    boost::mutex mutex;
+    //! Scanning threads wait on this for room in their queue or a file to scan.
+    boost::condition_variable condScanner;
+    //! The importer waits on this for blocks.
+    boost::condition_variable condImporter;
+    std::vector<CFileQueue> vFiles;
+    //! Number of files that may be scanned ahead of the one being imported.
+    const int nFilesAhead;
+    //! Next file to be picked up by a scanning thread.
+    int nNextFile;
+    //! File being imported.
+    int nImportFile;
+    bool fStop;
+
+    bool Found(int nFile, const boost::shared_ptr<CBlock>& pblock, const uint256& hash, CDiskBlockPos* dbp, unsigned int nSize);
+
+public:
+    CReindexScanner(int nFiles, int nFilesAheadIn) :
+        vFiles(nFiles), nFilesAhead(nFilesAheadIn), nNextFile(0), nImportFile(0), fStop(false) {}
+
+    //! Scanning thread loop: scan files until all have been taken.
+    void Thread();
+
+    /** Get the next block of file nFile, waiting for it if needed. Returns false once the file is done. */
+    bool Next(int nFile, CScannedBlock& scanned);
+
+    //! Make the scanning threads exit.
+    void Stop();
+};
+
+#endif // BITCOIN_BLOCKSTORAGE_H
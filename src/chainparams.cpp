@@ -40,6 +40,9 @@ public:
         consensus.nPowTargetTimespan = 14 * 24 * 60 * 60; // two weeks
         consensus.nPowTargetSpacing = 10 * 60;
         consensus.fPowAllowMinDifficultyBlocks = false;
+        // By default assume that the signatures in ancestors of this block are valid.
+        // No block past genesis is known yet, so verify everything.
+        consensus.defaultAssumeValid = uint256();
         /** 
          * The message start string is designed to be unlikely to occur in normal data.
          * The characters are rarely used upper ASCII, not valid as UTF-8, and produce
@@ -161,6 +164,9 @@ public:
         consensus.nMajorityRejectBlockOutdated = 75;
         consensus.nMajorityWindow = 100;
         consensus.fPowAllowMinDifficultyBlocks = true;
+        // By default assume that the signatures in ancestors of this block are valid.
+        // No block past genesis is known yet, so verify everything.
+        consensus.defaultAssumeValid = uint256();
         pchMessageStart[0] = 0xfa;
         pchMessageStart[1] = 0xbc;
         pchMessageStart[2] = 0xb3;
@@ -256,6 +262,8 @@ public:
         consensus.nMajorityRejectBlockOutdated = 950;
         consensus.nMajorityWindow = 1000;
         consensus.powLimit = uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+        // By default verify all signatures.
+        consensus.defaultAssumeValid = uint256();
         pchMessageStart[0] = 0xfb;
         pchMessageStart[1] = 0xbc;
         pchMessageStart[2] = 0xb3;
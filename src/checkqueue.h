@@ -127,6 +127,9 @@ private:
     }
 
 public:
+    //! Held by the CCheckQueueControl using the queue, so that only one master at a time feeds it.
+    boost::mutex ControlMutex;
+
     //! Create a new check queue
     CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
 
@@ -171,7 +174,8 @@ public:
 
 /** 
  * RAII-style controller object for a CCheckQueue that guarantees the passed
- * queue is finished before continuing.
+ * queue is finished before continuing. Controllers of the same queue in
+ * different threads wait for each other.
  */
 template <typename T>
 class CCheckQueueControl
@@ -183,8 +187,9 @@ private:
 public:
     CCheckQueueControl(CCheckQueue<T>* pqueueIn) : pqueue(pqueueIn), fDone(false)
     {
-        // passed queue is supposed to be unused, or NULL
+        // passed queue is supposed to be unused once we own it, or NULL
         if (pqueue != NULL) {
+            pqueue->ControlMutex.lock();
             bool isIdle = pqueue->IsIdle();
             assert(isIdle);
         }
@@ -209,6 +214,8 @@ public:
     {
         if (!fDone)
             Wait();
+        if (pqueue != NULL)
+            pqueue->ControlMutex.unlock();
     }
 };
 
@@ -4,10 +4,13 @@
 
 #include "coins.h"
 
+#include "consensus/consensus.h"
 #include "memusage.h"
 #include "random.h"
+#include "version.h"
 
 #include <assert.h>
+#include <stdexcept>
 
 /**
  * calculate number of bytes for the bitmask, and its number of non-zero bytes
@@ -41,98 +44,146 @@ bool CCoins::Spend(uint32_t nPos)
     return true;
 }
 
-bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
-bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
+bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
+bool CCoinsView::HaveCoin(const COutPoint &outpoint) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
-bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { return base->GetCoins(txid, coins); }
-bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
+bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
+CCoinsView* CCoinsViewBacked::GetBackend() const { return base; }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) { return base->BatchWrite(mapCoins, hashBlock, fErase); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
 
-CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
+SaltedOutpointHasher::SaltedOutpointHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
-
-CCoinsViewCache::~CCoinsViewCache()
-{
-    assert(!hasModifier);
-}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn),
+    cacheCoins(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), CCoinsMapAllocator(&cacheCoinsMemoryResource)),
+    cachedCoinsUsage(0), nHits(0), nMisses(0), nEvicted(0) { }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
 }
 
-CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
-    CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
+    if (it != cacheCoins.end()) {
+        nHits++;
+        it->second.flags |= CCoinsCacheEntry::RECENT;
         return it;
-    CCoins tmp;
-    if (!base->GetCoins(txid, tmp))
+    }
+    nMisses++;
+    Coin tmp;
+    if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
-    tmp.swap(ret->second.coins);
-    if (ret->second.coins.IsPruned()) {
-        // The parent only has an empty entry for this txid; we can consider our
+    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(outpoint, CCoinsCacheEntry())).first;
+    tmp.swap(ret->second.coin);
+    ret->second.flags = CCoinsCacheEntry::RECENT;
+    if (ret->second.coin.IsSpent()) {
+        // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
-        ret->second.flags = CCoinsCacheEntry::FRESH;
+        ret->second.flags |= CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += memusage::DynamicUsage(ret->second.coins);
+    cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
     return ret;
 }
 
-bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coins = it->second.coins;
-        return true;
+        coin = it->second.coin;
+        return !coin.IsSpent();
     }
     return false;
 }
 
-CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    size_t cachedCoinUsage = 0;
-    if (ret.second) {
-        if (!base->GetCoins(txid, ret.first->second.coins)) {
-            // The parent view does not have this entry; mark it as fresh.
-            ret.first->second.coins.Clear();
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        } else if (ret.first->second.coins.IsPruned()) {
-            // The parent view only has a pruned entry for this; mark it as fresh.
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        }
+void CCoinsViewCache::AddCoin(const COutPoint &outpoint, const Coin& coin, bool fPossibleOverwrite) {
+    assert(!coin.IsSpent());
+    if (coin.out.scriptPubKey.IsUnspendable())
+        return;
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(outpoint, CCoinsCacheEntry()));
+    CCoinsCacheEntry& entry = ret.first->second;
+    bool fFresh = false;
+    if (!ret.second)
+        cachedCoinsUsage -= entry.coin.DynamicMemoryUsage();
+    if (!fPossibleOverwrite) {
+        if (!entry.coin.IsSpent())
+            throw std::logic_error("Adding new coin that replaces non-spent entry");
+        // If the entry is not dirty, neither the parent view nor this cache
+        // has an unspent version of it, so the parent need not be told.
+        fFresh = !(entry.flags & CCoinsCacheEntry::DIRTY);
+    }
+    entry.coin = coin;
+    entry.flags |= CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::RECENT | (fFresh ? CCoinsCacheEntry::FRESH : 0);
+    cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+}
+
+void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool fCheck) {
+    bool fCoinBase = tx.IsCoinBase();
+    const uint256& txid = tx.GetHash();
+    for (size_t i = 0; i < tx.vout.size(); i++) {
+        const COutPoint outpoint(txid, i);
+        // Coinbases may always overwrite, to deal with the duplicate coinbase
+        // transactions from before BIP30.
+        bool fOverwrite = fCheck ? cache.HaveCoin(outpoint) : fCoinBase;
+        cache.AddCoin(outpoint, Coin(tx.vout[i], nHeight, fCoinBase, tx.nVersion), fOverwrite);
+    }
+}
+
+bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* pcoinOut) {
+    CCoinsMap::iterator it = FetchCoin(outpoint);
+    if (it == cacheCoins.end())
+        return false;
+    cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    if (pcoinOut)
+        pcoinOut->swap(it->second.coin);
+    if (it->second.flags & CCoinsCacheEntry::FRESH) {
+        cacheCoins.erase(it);
     } else {
-        cachedCoinUsage = memusage::DynamicUsage(ret.first->second.coins);
+        it->second.flags |= CCoinsCacheEntry::DIRTY;
+        it->second.coin.Clear();
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
     }
-    // Assume that whenever ModifyCoins is called, the entry will be modified.
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
+    return true;
 }
 
-const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+bool CCoinsViewCache::EmplaceCoinFromBase(const COutPoint &outpoint, Coin &coin) {
+    assert(!coin.IsSpent());
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(outpoint, CCoinsCacheEntry()));
+    if (!ret.second)
+        return false;
+    // This stands in for the miss the lookup would otherwise have had.
+    nMisses++;
+    ret.first->second.coin.swap(coin);
+    ret.first->second.flags = CCoinsCacheEntry::RECENT;
+    cachedCoinsUsage += ret.first->second.coin.DynamicMemoryUsage();
+    return true;
+}
+
+static const Coin coinEmpty;
+
+const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
-        return NULL;
+        return coinEmpty;
     } else {
-        return &it->second.coins;
+        return it->second.coin;
     }
 }
 
-bool CCoinsViewCache::HaveCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
-    // We're using vtx.empty() instead of IsPruned here for performance reasons,
-    // as we only care about the case where a transaction was replaced entirely
-    // in a reorganization (which wipes vout entirely, as opposed to spending
-    // which just cleans individual outputs).
-    return (it != cacheCoins.end() && !it->second.coins.vout.empty());
+bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+}
+
+bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const {
@@ -145,62 +196,182 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
-    assert(!hasModifier);
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, bool fErase) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
             if (itUs == cacheCoins.end()) {
-                if (!it->second.coins.IsPruned()) {
-                    // The parent cache does not have an entry, while the child
-                    // cache does have (a non-pruned) one. Move the data up, and
-                    // mark it as fresh (if the grandparent did have it, we
-                    // would have pulled it in at first GetCoins).
-                    assert(it->second.flags & CCoinsCacheEntry::FRESH);
+                // The parent cache does not have an entry, while the child does. It
+                // can be ignored if it is both fresh and spent in the child.
+                if (!((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent())) {
+                    // Otherwise move the data up. It stays fresh only if it was
+                    // fresh in the child; if not, it may just have been flushed from
+                    // this cache and still exist in the grandparent.
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += memusage::DynamicUsage(entry.coins);
-                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    if (fErase)
+                        entry.coin.swap(it->second.coin);
+                    else
+                        entry.coin = it->second.coin;
+                    cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::RECENT | (it->second.flags & CCoinsCacheEntry::FRESH);
                 }
             } else {
-                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+                // A child entry can only be fresh if this cache's copy is spent;
+                // anything else means the FRESH flag was misapplied.
+                if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coin.IsSpent())
+                    throw std::logic_error("FRESH flag misapplied to cache entry for an unspent coin");
+
+                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent()) {
                     // The grandparent does not have an entry, and the child is
-                    // modified and being pruned. This means we can just delete
+                    // modified and being spent. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= memusage::DynamicUsage(itUs->second.coins);
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
-                    // A normal modification.
-                    cachedCoinsUsage -= memusage::DynamicUsage(itUs->second.coins);
-                    itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += memusage::DynamicUsage(itUs->second.coins);
-                    itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    // A normal modification. The child's FRESH flag is not copied:
+                    // this cache's spent entry may still have to reach the grandparent.
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                    if (fErase)
+                        itUs->second.coin.swap(it->second.coin);
+                    else
+                        itUs->second.coin = it->second.coin;
+                    cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
+                    itUs->second.flags |= CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::RECENT;
                 }
             }
         }
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            it++;
+        }
     }
     hashBlock = hashBlockIn;
     return true;
 }
 
+/**
+ * Erasing cache entries leaves their nodes in the pool. Once most of the pool
+ * is unused like that, it is worth moving the remaining entries so that the
+ * cache does not keep its peak size for good.
+ */
+static bool IsPoolMostlyUnused(const CCoinsMapMemoryResource& resource)
+{
+    return resource.NumAllocatedChunks() > 1 && resource.BytesAllocated() > 2 * resource.BytesInUse();
+}
+
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, true);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
     return fOk;
 }
 
+bool CCoinsViewCache::Sync() {
+    // Let the base read the dirty entries in place rather than from a copy,
+    // which would double the memory used by them at the worst moment.
+    if (!base->BatchWrite(cacheCoins, hashBlock, false))
+        return false;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            if (it->second.coin.IsSpent()) {
+                // The base no longer has it either; there is nothing left to remember.
+                cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+                CCoinsMap::iterator itOld = it++;
+                cacheCoins.erase(itOld);
+                continue;
+            }
+            it->second.flags &= ~(CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH);
+        }
+        it++;
+    }
+    if (IsPoolMostlyUnused(cacheCoinsMemoryResource))
+        ReallocateCache();
+    return true;
+}
+
+size_t CCoinsViewCache::Trim(size_t nTargetUsage) {
+    size_t nEvictedNow = 0;
+    CCoinsMap::iterator it = cacheCoins.find(clockHand);
+    if (it == cacheCoins.end())
+        it = cacheCoins.begin();
+    // Two full turns of the clock visit every clean entry at least once with
+    // its RECENT flag cleared.
+    size_t nSteps = 2 * cacheCoins.size();
+    while (DynamicMemoryUsage() > nTargetUsage && nSteps-- > 0 && !cacheCoins.empty()) {
+        if (it == cacheCoins.end())
+            it = cacheCoins.begin();
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            it++;
+        } else if (it->second.flags & CCoinsCacheEntry::RECENT) {
+            it->second.flags &= ~CCoinsCacheEntry::RECENT;
+            it++;
+        } else {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            CCoinsMap::iterator itOld = it++;
+            cacheCoins.erase(itOld);
+            nEvictedNow++;
+        }
+    }
+    if (it != cacheCoins.end())
+        clockHand = it->first;
+    nEvicted += nEvictedNow;
+    if (IsPoolMostlyUnused(cacheCoinsMemoryResource))
+        ReallocateCache();
+    return nEvictedNow;
+}
+
+void CCoinsViewCache::ReallocateCache() {
+    // Park the entries in a map on a pool of its own, so that no block of the
+    // cache's pool is in use any more and all of its chunks can be released.
+    CCoinsMapMemoryResource resourceTmp;
+    CCoinsMap mapTmp(cacheCoins.size(), cacheCoins.hash_function(), cacheCoins.key_eq(), CCoinsMapAllocator(&resourceTmp));
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        CCoinsCacheEntry& entry = mapTmp[it->first];
+        entry.coin.swap(it->second.coin);
+        entry.flags = it->second.flags;
+    }
+    // Clearing keeps the bucket array; swapping with an empty map frees it too.
+    cacheCoins.clear();
+    CCoinsMap(0, cacheCoins.hash_function(), cacheCoins.key_eq(), cacheCoins.get_allocator()).swap(cacheCoins);
+    cacheCoinsMemoryResource.Release();
+    if (mapTmp.empty())
+        return;
+    cacheCoins.rehash(mapTmp.size());
+    for (CCoinsMap::iterator it = mapTmp.begin(); it != mapTmp.end(); it++) {
+        CCoinsCacheEntry& entry = cacheCoins[it->first];
+        entry.coin.swap(it->second.coin);
+        entry.flags = it->second.flags;
+    }
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
 
+void CCoinsViewCache::GetCacheStats(CCoinsCacheStats &stats) const {
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nEvicted = nEvicted;
+    stats.nEntries = cacheCoins.size();
+    stats.nDirtyEntries = 0;
+    stats.nDirtyUsage = 0;
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            stats.nDirtyEntries++;
+            stats.nDirtyUsage += it->second.coin.DynamicMemoryUsage();
+        }
+    }
+    stats.nUsage = DynamicMemoryUsage();
+}
+
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
-    const CCoins* coins = AccessCoins(input.prevout.hash);
-    assert(coins && coins->IsAvailable(input.prevout.n));
-    return coins->vout[input.prevout.n];
+    const Coin& coin = AccessCoin(input.prevout);
+    assert(!coin.IsSpent());
+    return coin.out;
 }
 
 CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
@@ -219,9 +390,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins* coins = AccessCoins(prevout.hash);
-            if (!coins || !coins->IsAvailable(prevout.n)) {
+            if (!HaveCoin(tx.vin[i].prevout)) {
                 return false;
             }
         }
@@ -236,31 +405,25 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     double dResult = 0.0;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        const CCoins* coins = AccessCoins(txin.prevout.hash);
-        assert(coins);
-        if (!coins->IsAvailable(txin.prevout.n)) continue;
-        if (coins->nHeight < nHeight) {
-            dResult += coins->vout[txin.prevout.n].nValue * (nHeight-coins->nHeight);
+        const Coin& coin = AccessCoin(txin.prevout);
+        if (coin.IsSpent()) continue;
+        if (coin.nHeight < (unsigned int)nHeight) {
+            dResult += coin.out.nValue * (nHeight-coin.nHeight);
         }
     }
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
-    assert(!cache.hasModifier);
-    cache.hasModifier = true;
-}
+static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_SIZE / ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
 
-CCoinsModifier::~CCoinsModifier()
+const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
 {
-    assert(cache.hasModifier);
-    cache.hasModifier = false;
-    it->second.coins.Cleanup();
-    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
-    if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-        cache.cacheCoins.erase(it);
-    } else {
-        // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += memusage::DynamicUsage(it->second.coins);
+    COutPoint iter(txid, 0);
+    while (iter.n < MAX_OUTPUTS_PER_BLOCK) {
+        const Coin& alternate = view.AccessCoin(iter);
+        if (!alternate.IsSpent())
+            return alternate;
+        ++iter.n;
     }
+    return coinEmpty;
 }
@@ -9,16 +9,109 @@
 #include "compressor.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <functional>
+
 #include <boost/foreach.hpp>
 #include <boost/unordered_map.hpp>
 
+/**
+ * A UTXO entry: one unspent transaction output, and the metadata of the
+ * transaction that created it.
+ *
+ * Serialized format:
+ * - VARINT(nHeight * 2 + fCoinBase)
+ * - VARINT(nVersion)
+ * - the CTxOut (via CTxOutCompressor)
+ *
+ * This matches the format of a CTxInUndo that carries its metadata.
+ */
+class Coin
+{
+public:
+    //! unspent transaction output; IsNull() once spent
+    CTxOut out;
+
+    //! whether the containing transaction was a coinbase
+    bool fCoinBase;
+
+    //! at which height the containing transaction was included in the active block chain
+    unsigned int nHeight;
+
+    //! version of the containing transaction
+    int nVersion;
+
+    Coin() : fCoinBase(false), nHeight(0), nVersion(0) {}
+    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, int nVersionIn) :
+        out(outIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), nVersion(nVersionIn) {}
+
+    void Clear() {
+        out.SetNull();
+        // Release the script's storage too, so a spent coin has no dynamic usage.
+        CScript().swap(out.scriptPubKey);
+        fCoinBase = false;
+        nHeight = 0;
+        nVersion = 0;
+    }
+
+    bool IsCoinBase() const {
+        return fCoinBase;
+    }
+
+    bool IsSpent() const {
+        return out.IsNull();
+    }
+
+    void swap(Coin& to) {
+        // Swap the script buffers themselves, so no copy is made and the
+        // memory each side accounts for moves along with it.
+        std::swap(to.out.nValue, out.nValue);
+        to.out.scriptPubKey.swap(out.scriptPubKey);
+        std::swap(to.fCoinBase, fCoinBase);
+        std::swap(to.nHeight, nHeight);
+        std::swap(to.nVersion, nVersion);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return ::GetSerializeSize(VARINT(nHeight * 2 + (fCoinBase ? 1 : 0)), nType, nVersion) +
+               ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion) +
+               ::GetSerializeSize(CTxOutCompressor(REF(out)), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        assert(!IsSpent());
+        ::Serialize(s, VARINT(nHeight * 2 + (fCoinBase ? 1 : 0)), nType, nVersion);
+        ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
+        ::Serialize(s, CTxOutCompressor(REF(out)), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        nHeight = nCode / 2;
+        fCoinBase = nCode & 1;
+        ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
+        ::Unserialize(s, REF(CTxOutCompressor(out)), nType, nVersion);
+    }
+
+    size_t DynamicMemoryUsage() const {
+        return memusage::DynamicUsage(*static_cast<const std::vector<unsigned char>*>(&out.scriptPubKey));
+    }
+};
+
 /** 
- * Pruned version of CTransaction: only retains metadata and unspent transaction outputs
+ * Pruned version of CTransaction: only retains metadata and unspent transaction outputs.
+ *
+ * This was the per-transaction record format of the coin database before it
+ * was keyed by outpoint; it is only still used to read and upgrade such a
+ * database (see CCoinsViewDB::Upgrade).
  *
  * Serialized format:
  * - VARINT(nVersion)
@@ -264,38 +357,62 @@ public:
     }
 };
 
-class CCoinsKeyHasher
+class SaltedOutpointHasher
 {
 private:
     uint256 salt;
 
 public:
-    CCoinsKeyHasher();
+    SaltedOutpointHasher();
 
     /**
      * This *must* return size_t. With Boost 1.46 on 32-bit systems the
      * unordered_map will behave unpredictably if the custom hasher returns a
      * uint64_t, resulting in failures when syncing the chain (#4634).
      */
-    size_t operator()(const uint256& key) const {
-        return key.GetHash(salt);
+    size_t operator()(const COutPoint& outpoint) const {
+        return outpoint.hash.GetHash(salt) ^ ((uint64_t)outpoint.n * 0x9e3779b97f4a7c15ULL);
     }
 };
 
 struct CCoinsCacheEntry
 {
-    CCoins coins; // The actual cached data.
+    Coin coin; // The actual cached data.
     unsigned char flags;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
-        FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        FRESH = (1 << 1), // The parent view does not have this entry (or it is spent).
+        RECENT = (1 << 2), // This entry was used since the eviction clock last passed it (see CCoinsViewCache::Trim).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coin(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/**
+ * The nodes of a CCoinsMap come from a pool owned by the map's user (see
+ * PoolResource), sized so that a node and the hash table's bookkeeping fit in
+ * one pooled block. This avoids a malloc/free pair per cached coin, and makes
+ * the memory used by the live nodes easy to account for.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                      sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4> CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef boost::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
+
+/** Counters describing how well a CCoinsViewCache serves its users. */
+struct CCoinsCacheStats
+{
+    uint64_t nHits;         //!< lookups answered from the cache
+    uint64_t nMisses;       //!< lookups passed on to the backing view
+    uint64_t nEvicted;      //!< clean entries dropped by Trim
+    size_t nEntries;        //!< number of cached entries
+    size_t nDirtyEntries;   //!< number of entries not yet written to the backing view
+    size_t nDirtyUsage;     //!< dynamic memory usage of the coins in those entries
+    size_t nUsage;          //!< total dynamic memory usage of the cache
+
+    CCoinsCacheStats() : nHits(0), nMisses(0), nEvicted(0), nEntries(0), nDirtyEntries(0), nDirtyUsage(0), nUsage(0) {}
+};
 
 struct CCoinsStats
 {
@@ -315,19 +432,20 @@ struct CCoinsStats
 class CCoinsView
 {
 public:
-    //! Retrieve the CCoins (unspent transaction outputs) for a given txid
-    virtual bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    //! Retrieve the Coin (unspent transaction output) for a given outpoint.
+    //! Returns true only when an unspent coin was found, which is returned in coin.
+    virtual bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
 
-    //! Just check whether we have data for a given txid.
-    //! This may (but cannot always) return true for fully spent transactions
-    virtual bool HaveCoins(const uint256 &txid) const;
+    //! Just check whether a given outpoint is unspent.
+    virtual bool HaveCoin(const COutPoint &outpoint) const;
 
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
-    //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! Do a bulk modification (multiple Coin changes + BestBlock change).
+    //! If fErase is set, the entries of the passed mapCoins are consumed (and
+    //! the map left empty); otherwise it is only read from.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
@@ -345,79 +463,82 @@ protected:
 
 public:
     CCoinsViewBacked(CCoinsView *viewIn);
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
+    CCoinsView* GetBackend() const;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
     bool GetStats(CCoinsStats &stats) const;
 };
 
 
-class CCoinsViewCache;
-
-/** 
- * A reference to a mutable cache entry. Encapsulating it allows us to run
- *  cleanup code after the modification is finished, and keeping track of
- *  concurrent modifications. 
- */
-class CCoinsModifier
-{
-private:
-    CCoinsViewCache& cache;
-    CCoinsMap::iterator it;
-    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
-
-public:
-    CCoins* operator->() { return &it->second.coins; }
-    CCoins& operator*() { return it->second.coins; }
-    ~CCoinsModifier();
-    friend class CCoinsViewCache;
-};
-
-/** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+/** CCoinsView that adds a memory cache for transaction outputs to another CCoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
-    /* Whether this cache has an active modifier. */
-    bool hasModifier;
-
-
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
 
-    /* Cached dynamic memory usage for the inner CCoins objects. */
+    /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Lookup and eviction counters, see GetCacheStats. */
+    mutable uint64_t nHits;
+    mutable uint64_t nMisses;
+    uint64_t nEvicted;
+
+    /* Position of the eviction clock hand: the entry Trim continues from. */
+    COutPoint clockHand;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
-    ~CCoinsViewCache();
 
     // Standard CCoinsView methods
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
 
     /**
-     * Return a pointer to CCoins in the cache, or NULL if not found. This is
-     * more efficient than GetCoins. Modifications to other cache entries are
-     * allowed while accessing the returned pointer.
+     * Check if we have the given utxo already loaded in this cache.
+     * The semantics are the same as HaveCoin(), but no calls to
+     * the backing CCoinsView are made.
      */
-    const CCoins* AccessCoins(const uint256 &txid) const;
+    bool HaveCoinInCache(const COutPoint &outpoint) const;
 
     /**
-     * Return a modifiable reference to a CCoins. If no entry with the given
-     * txid exists, a new one is created. Simultaneous modifications are not
-     * allowed.
+     * Return a reference to Coin in the cache, or a spent coin if not found. This is
+     * more efficient than GetCoin. Modifications to other cache entries are
+     * allowed while accessing the returned reference, but not to this entry.
      */
-    CCoinsModifier ModifyCoins(const uint256 &txid);
+    const Coin& AccessCoin(const COutPoint &outpoint) const;
+
+    /**
+     * Add a coin. Set fPossibleOverwrite if an unspent version may
+     * already exist in the cache.
+     */
+    void AddCoin(const COutPoint& outpoint, const Coin& coin, bool fPossibleOverwrite);
+
+    /**
+     * Spend a coin. Pass pcoinOut to receive the spent coin (for undo data).
+     * Returns false if the coin was not found.
+     */
+    bool SpendCoin(const COutPoint &outpoint, Coin* pcoinOut = NULL);
+
+    /**
+     * Insert an unspent coin that was read from the base view ahead of time, as
+     * if a lookup had fetched it. The coin must be exactly what the base has;
+     * this is only meant for prefetching. Its contents are moved out of coin.
+     * Returns false, and does nothing, if the outpoint is already cached.
+     */
+    bool EmplaceCoinFromBase(const COutPoint &outpoint, Coin &coin);
 
     /**
      * Push the modifications applied to this cache to its base.
@@ -426,12 +547,31 @@ public:
      */
     bool Flush();
 
-    //! Calculate the size of the cache (in number of transactions)
+    /**
+     * Push the modifications applied to this cache to its base, but keep the
+     * cached entries: unspent ones stay resident as clean entries, so lookups
+     * right after a write do not all have to go back to the base.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync();
+
+    /**
+     * Evict clean (non-dirty) entries until the cache uses at most nTargetUsage
+     * bytes, or no clean entries are left. Entries are picked with the CLOCK
+     * policy: an entry that was used since the clock hand last passed it gets
+     * a second chance. Returns the number of evicted entries.
+     */
+    size_t Trim(size_t nTargetUsage);
+
+    //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Fill in hit, eviction and dirty entry statistics. This scans the whole cache.
+    void GetCacheStats(CCoinsCacheStats &stats) const;
+
     /** 
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -450,11 +590,14 @@ public:
 
     const CTxOut &GetOutputFor(const CTxIn& input) const;
 
-    friend class CCoinsModifier;
-
 private:
-    CCoinsMap::iterator FetchCoins(const uint256 &txid);
-    CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
+    CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+
+    /**
+     * Move the cached entries onto fresh pool chunks, returning the memory of
+     * erased entries (which the pool keeps for reuse) to the system.
+     */
+    void ReallocateCache();
 
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
@@ -462,4 +605,13 @@ private:
     CCoinsViewCache(const CCoinsViewCache &);
 };
 
+//! Add all of a transaction's spendable outputs to a cache, as created at height nHeight.
+//! With fCheck, outputs that already exist are overwritten (only ever needed for the
+//! duplicate coinbases from before BIP30); otherwise only coinbase outputs may be.
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool fCheck = false);
+
+//! Utility function to find any unspent output with a given txid.
+//! This may scan many outpoints that are absent, so avoid it on hot paths.
+const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
+
 #endif // BITCOIN_COINS_H
@@ -25,6 +25,8 @@ struct Params {
     int64_t nPowTargetSpacing;
     int64_t nPowTargetTimespan;
     int64_t DifficultyAdjustmentInterval() const { return nPowTargetTimespan / nPowTargetSpacing; }
+    /** By default assume that the signatures in ancestors of this block are valid */
+    uint256 defaultAssumeValid;
 };
 } // namespace Consensus
 
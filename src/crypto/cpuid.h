@@ -0,0 +1,71 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_CPUID_H
+#define BITCOIN_CRYPTO_CPUID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#define HAVE_X86_CPUID 1
+#include <cpuid.h>
+#endif
+
+/** Runtime detection of the instruction set extensions used by the
+ *  optional crypto backends. All functions return false on non-x86 hosts.
+ */
+namespace cpuid
+{
+#ifdef HAVE_X86_CPUID
+/** Whether the OS saves the AVX (YMM) register state on context switches. */
+bool static inline AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+
+bool static inline Leaf1(uint32_t& ecx, uint32_t& edx)
+{
+    uint32_t eax, ebx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+}
+
+bool static inline Leaf7(uint32_t& ebx)
+{
+    uint32_t eax, ecx, edx;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return true;
+}
+
+bool static inline HasSSE41()
+{
+    uint32_t ecx, edx;
+    return Leaf1(ecx, edx) && (ecx >> 19 & 1);
+}
+
+bool static inline HasAVX2()
+{
+    uint32_t ecx, edx, ebx;
+    if (!Leaf1(ecx, edx) || !(ecx >> 27 & 1) || !AVXEnabled()) // OSXSAVE
+        return false;
+    return Leaf7(ebx) && (ebx >> 5 & 1);
+}
+
+bool static inline HasSHANI()
+{
+    uint32_t ebx;
+    return HasSSE41() && Leaf7(ebx) && (ebx >> 29 & 1);
+}
+#else
+bool static inline HasSSE41() { return false; }
+bool static inline HasAVX2() { return false; }
+bool static inline HasSHANI() { return false; }
+#endif
+} // namespace cpuid
+
+#endif // BITCOIN_CRYPTO_CPUID_H
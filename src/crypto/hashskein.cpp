@@ -0,0 +1,153 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/hashskein.h"
+
+#include "crypto/common.h"
+#include "crypto/cpuid.h"
+#include "crypto/sha256.h"
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef ENABLE_SSE41
+namespace hashskein_sse41
+{
+void Skein512_80_2way(unsigned char* out, const unsigned char* in);
+void Skein512_Tail_2way(unsigned char* out, const uint64_t* chain, const unsigned char* tails);
+void Sha256_64_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#ifdef ENABLE_AVX2
+namespace hashskein_avx2
+{
+void Skein512_80_4way(unsigned char* out, const unsigned char* in);
+void Skein512_Tail_4way(unsigned char* out, const uint64_t* chain, const unsigned char* tails);
+void Sha256_64_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+// Internal implementation code.
+namespace
+{
+/// Portable one-lane fallbacks, used for the remainder of every batch.
+namespace hashskein_scalar
+{
+void Skein512_80(unsigned char* out, const unsigned char* in)
+{
+    sph_skein512_context ctx;
+    sph_skein512_init(&ctx);
+    sph_skein512(&ctx, in, 80);
+    sph_skein512_close(&ctx, out);
+}
+
+void Skein512_Tail(unsigned char* out, const sph_skein512_context& midstate, const unsigned char* tail)
+{
+    sph_skein512_context ctx = midstate;
+    sph_skein512(&ctx, tail, CSkeinHeaderMidstate::TAIL_SIZE);
+    sph_skein512_close(&ctx, out);
+}
+
+void Sha256_64(unsigned char* out, const unsigned char* in)
+{
+    CSHA256().Write(in, 64).Finalize(out);
+}
+} // namespace hashskein_scalar
+
+typedef void (*Skein512_80Fn)(unsigned char*, const unsigned char*);
+typedef void (*Skein512_TailFn)(unsigned char*, const uint64_t*, const unsigned char*);
+typedef void (*Sha256_64Fn)(unsigned char*, const unsigned char*);
+
+/** Currently selected multi-lane implementation (ways == 1 means none). */
+struct SkeinImpl
+{
+    const char* name;
+    size_t skeinWays;
+    Skein512_80Fn skein80;
+    Skein512_TailFn skeinTail;
+    size_t shaWays;
+    Sha256_64Fn sha64;
+};
+
+SkeinImpl impl = {"scalar", 1, NULL, NULL, 1, NULL};
+
+void Sha256Batch(unsigned char* out, const unsigned char* in, size_t count)
+{
+    size_t i = 0;
+    if (impl.shaWays > 1) {
+        for (; i + impl.shaWays <= count; i += impl.shaWays)
+            impl.sha64(out + i * 32, in + i * 64);
+    }
+    for (; i < count; i++)
+        hashskein_scalar::Sha256_64(out + i * 32, in + i * 64);
+}
+} // namespace
+
+void CSkeinHeaderMidstate::FinalizeBatch(unsigned char* out, const unsigned char* ptails, size_t count) const
+{
+    const uint64_t chain[8] = {ctx_skein.h0, ctx_skein.h1, ctx_skein.h2, ctx_skein.h3,
+                               ctx_skein.h4, ctx_skein.h5, ctx_skein.h6, ctx_skein.h7};
+    unsigned char skein[SKEIN_BATCH_SIZE * 64];
+
+    while (count > 0) {
+        size_t n = std::min(count, SKEIN_BATCH_SIZE);
+        size_t i = 0;
+        if (impl.skeinWays > 1) {
+            for (; i + impl.skeinWays <= n; i += impl.skeinWays)
+                impl.skeinTail(skein + i * 64, chain, ptails + i * TAIL_SIZE);
+        }
+        for (; i < n; i++)
+            hashskein_scalar::Skein512_Tail(skein + i * 64, ctx_skein, ptails + i * TAIL_SIZE);
+        Sha256Batch(out, skein, n);
+
+        out += n * 32;
+        ptails += n * TAIL_SIZE;
+        count -= n;
+    }
+}
+
+void HashSkeinHeaders(unsigned char* out, const unsigned char* pheaders, size_t count)
+{
+    unsigned char skein[SKEIN_BATCH_SIZE * 64];
+
+    while (count > 0) {
+        size_t n = std::min(count, SKEIN_BATCH_SIZE);
+        size_t i = 0;
+        if (impl.skeinWays > 1) {
+            for (; i + impl.skeinWays <= n; i += impl.skeinWays)
+                impl.skein80(skein + i * 64, pheaders + i * 80);
+        }
+        for (; i < n; i++)
+            hashskein_scalar::Skein512_80(skein + i * 64, pheaders + i * 80);
+        Sha256Batch(out, skein, n);
+
+        out += n * 32;
+        pheaders += n * 80;
+        count -= n;
+    }
+}
+
+std::string SkeinAutoDetect()
+{
+#ifdef ENABLE_AVX2
+    if (cpuid::HasAVX2()) {
+        SkeinImpl avx2 = {"avx2(4-way skein, 8-way sha256)", 4, hashskein_avx2::Skein512_80_4way,
+                          hashskein_avx2::Skein512_Tail_4way, 8, hashskein_avx2::Sha256_64_8way};
+        impl = avx2;
+        return impl.name;
+    }
+#endif
+#ifdef ENABLE_SSE41
+    if (cpuid::HasSSE41()) {
+        SkeinImpl sse41 = {"sse4.1(2-way skein, 4-way sha256)", 2, hashskein_sse41::Skein512_80_2way,
+                           hashskein_sse41::Skein512_Tail_2way, 4, hashskein_sse41::Sha256_64_4way};
+        impl = sse41;
+        return impl.name;
+    }
+#endif
+    SkeinImpl scalar = {"scalar", 1, NULL, NULL, 1, NULL};
+    impl = scalar;
+    return impl.name;
+}
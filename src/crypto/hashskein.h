@@ -11,6 +11,7 @@
 
 #include <openssl/sha.h>
 #include <openssl/ripemd.h>
+#include <string>
 #include <vector>
 
 
@@ -33,5 +34,61 @@ inline uint256 HashSkein(const T1 pbegin, const T1 pend)
     return hash2;
 }
 
+/** Skein-512 state after the first 64 bytes of an 80-byte block header.
+ *  While scanning nonces only the trailing 16 bytes (the end of
+ *  hashMerkleRoot, nTime, nBits and nNonce) change, so the first UBI block
+ *  is compressed once per template and each candidate only processes the
+ *  tail. The result is identical to HashSkein over the whole header.
+ */
+class CSkeinHeaderMidstate
+{
+private:
+    sph_skein512_context ctx_skein;
+
+public:
+    static const size_t HEADER_SIZE = 80;
+    static const size_t PREFIX_SIZE = 64;
+    static const size_t TAIL_SIZE = HEADER_SIZE - PREFIX_SIZE;
+
+    explicit CSkeinHeaderMidstate(const unsigned char* pheader)
+    {
+        sph_skein512_init(&ctx_skein);
+        sph_skein512(&ctx_skein, pheader, PREFIX_SIZE);
+        sph_skein512_midstate(&ctx_skein);
+    }
+
+    uint256 Finalize(const unsigned char* ptail) const
+    {
+        sph_skein512_context ctx_tail = ctx_skein;
+        uint512 hash1;
+        uint256 hash2;
+
+        sph_skein512(&ctx_tail, ptail, TAIL_SIZE);
+        sph_skein512_close(&ctx_tail, static_cast<void*>(&hash1));
+
+        SHA256((unsigned char*)&hash1, 64, (unsigned char*)&hash2);
+
+        return hash2;
+    }
+
+    /** Hash `count` candidates given as consecutive TAIL_SIZE-byte tails,
+     *  writing 32 bytes per candidate to out. Uses the multi-lane
+     *  implementation selected by SkeinAutoDetect(). */
+    void FinalizeBatch(unsigned char* out, const unsigned char* ptails, size_t count) const;
+};
+
+/** Number of headers the miner hashes per FinalizeBatch() call. */
+static const size_t SKEIN_BATCH_SIZE = 8;
+
+/** Compute the proof-of-work hash (Skein-512 followed by SHA256, identical
+ *  to HashSkein) of `count` consecutive 80-byte block headers, writing 32
+ *  bytes per header to out.
+ */
+void HashSkeinHeaders(unsigned char* out, const unsigned char* pheaders, size_t count);
+
+/** Select the fastest multi-lane Skein-512/SHA256 implementation supported
+ *  by this CPU. Returns a description of the chosen implementation.
+ */
+std::string SkeinAutoDetect();
 
 #endif
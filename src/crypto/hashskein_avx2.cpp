@@ -0,0 +1,77 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 4-way Skein-512 and 8-way SHA-256 using AVX2 registers.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace
+{
+/** 4 lanes of 64-bit words. */
+struct V64
+{
+    static const int WAYS = 4;
+    __m256i v;
+
+    V64() {}
+    V64(__m256i x) : v(x) {}
+    static V64 inline Broadcast(uint64_t x) { return _mm256_set1_epi64x(x); }
+    static V64 inline Load(const uint64_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    void inline Store(uint64_t* p) const { _mm256_storeu_si256((__m256i*)p, v); }
+};
+
+V64 inline operator+(V64 x, V64 y) { return _mm256_add_epi64(x.v, y.v); }
+V64 inline operator^(V64 x, V64 y) { return _mm256_xor_si256(x.v, y.v); }
+template<int n> V64 inline Rotl(V64 x) { return _mm256_or_si256(_mm256_slli_epi64(x.v, n), _mm256_srli_epi64(x.v, 64 - n)); }
+
+/** 8 lanes of 32-bit words. */
+struct V32
+{
+    static const int WAYS = 8;
+    __m256i v;
+
+    V32() {}
+    V32(__m256i x) : v(x) {}
+    static V32 inline Broadcast(uint32_t x) { return _mm256_set1_epi32(x); }
+    static V32 inline Load(const uint32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    void inline Store(uint32_t* p) const { _mm256_storeu_si256((__m256i*)p, v); }
+};
+
+V32 inline operator+(V32 x, V32 y) { return _mm256_add_epi32(x.v, y.v); }
+V32 inline operator^(V32 x, V32 y) { return _mm256_xor_si256(x.v, y.v); }
+V32 inline operator&(V32 x, V32 y) { return _mm256_and_si256(x.v, y.v); }
+V32 inline operator|(V32 x, V32 y) { return _mm256_or_si256(x.v, y.v); }
+template<int n> V32 inline Shr(V32 x) { return _mm256_srli_epi32(x.v, n); }
+template<int n> V32 inline Shl(V32 x) { return _mm256_slli_epi32(x.v, n); }
+} // namespace
+
+#include "crypto/skein_multiway.h"
+
+namespace hashskein_avx2
+{
+void Skein512_80_4way(unsigned char* out, const unsigned char* in)
+{
+    skein_multiway::Skein512_80<V64>(out, in);
+}
+
+void Skein512_Tail_4way(unsigned char* out, const uint64_t* chain, const unsigned char* tails)
+{
+    skein_multiway::Skein512_Tail<V64>(out, chain, tails);
+}
+
+void Sha256_64_8way(unsigned char* out, const unsigned char* in)
+{
+    skein_multiway::Sha256_64<V32>(out, in);
+}
+
+void Sha256D64_8way(unsigned char* out, const unsigned char* in)
+{
+    skein_multiway::Sha256D64<V32>(out, in);
+}
+} // namespace hashskein_avx2
+
+#endif // ENABLE_AVX2
@@ -0,0 +1,77 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 2-way Skein-512 and 4-way SHA-256 using SSE4.1 registers.
+
+#ifdef ENABLE_SSE41
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace
+{
+/** 2 lanes of 64-bit words. */
+struct V64
+{
+    static const int WAYS = 2;
+    __m128i v;
+
+    V64() {}
+    V64(__m128i x) : v(x) {}
+    static V64 inline Broadcast(uint64_t x) { return _mm_set1_epi64x(x); }
+    static V64 inline Load(const uint64_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    void inline Store(uint64_t* p) const { _mm_storeu_si128((__m128i*)p, v); }
+};
+
+V64 inline operator+(V64 x, V64 y) { return _mm_add_epi64(x.v, y.v); }
+V64 inline operator^(V64 x, V64 y) { return _mm_xor_si128(x.v, y.v); }
+template<int n> V64 inline Rotl(V64 x) { return _mm_or_si128(_mm_slli_epi64(x.v, n), _mm_srli_epi64(x.v, 64 - n)); }
+
+/** 4 lanes of 32-bit words. */
+struct V32
+{
+    static const int WAYS = 4;
+    __m128i v;
+
+    V32() {}
+    V32(__m128i x) : v(x) {}
+    static V32 inline Broadcast(uint32_t x) { return _mm_set1_epi32(x); }
+    static V32 inline Load(const uint32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    void inline Store(uint32_t* p) const { _mm_storeu_si128((__m128i*)p, v); }
+};
+
+V32 inline operator+(V32 x, V32 y) { return _mm_add_epi32(x.v, y.v); }
+V32 inline operator^(V32 x, V32 y) { return _mm_xor_si128(x.v, y.v); }
+V32 inline operator&(V32 x, V32 y) { return _mm_and_si128(x.v, y.v); }
+V32 inline operator|(V32 x, V32 y) { return _mm_or_si128(x.v, y.v); }
+template<int n> V32 inline Shr(V32 x) { return _mm_srli_epi32(x.v, n); }
+template<int n> V32 inline Shl(V32 x) { return _mm_slli_epi32(x.v, n); }
+} // namespace
+
+#include "crypto/skein_multiway.h"
+
+namespace hashskein_sse41
+{
+void Skein512_80_2way(unsigned char* out, const unsigned char* in)
+{
+    skein_multiway::Skein512_80<V64>(out, in);
+}
+
+void Skein512_Tail_2way(unsigned char* out, const uint64_t* chain, const unsigned char* tails)
+{
+    skein_multiway::Skein512_Tail<V64>(out, chain, tails);
+}
+
+void Sha256_64_4way(unsigned char* out, const unsigned char* in)
+{
+    skein_multiway::Sha256_64<V32>(out, in);
+}
+
+void Sha256D64_4way(unsigned char* out, const unsigned char* in)
+{
+    skein_multiway::Sha256D64<V32>(out, in);
+}
+} // namespace hashskein_sse41
+
+#endif // ENABLE_SSE41
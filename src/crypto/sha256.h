@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,20 @@ public:
     CSHA256& Reset();
 };
 
+/** Compute the double-SHA256 of `blocks` independent 64-byte inputs,
+ *  writing 32 bytes per input to out. Inputs are hashed several at a time
+ *  when a multi-lane implementation is available.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+
+/** Autodetect the best available SHA256 implementation for this CPU and
+ *  select it: SHA-NI for the transform, or the SSE4.1/AVX2 multi-lane
+ *  kernels for SHA256D64. Returns a description of the chosen
+ *  implementation.
+ */
+std::string SHA256AutoDetect();
+
+/** Check the selected SHA256 transform against known answers. */
+bool SHA256SelfTest();
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -905,6 +905,32 @@ skein_big_core(sph_skein_big_context *sc, const void *data, size_t len)
 	sc->ptr = ptr;
 }
 
+static void
+skein_big_midstate(sph_skein_big_context *sc)
+{
+	/*
+	 * skein_big_core() keeps a full block buffered because it cannot
+	 * tell whether it is the final one. When the caller knows more
+	 * data will follow, the buffered block can be compressed right
+	 * away as a non-final block; the resulting context then holds
+	 * only the chaining value and may be cloned for each message
+	 * that shares this prefix.
+	 */
+	unsigned char *buf;
+	unsigned first;
+	DECL_STATE_BIG
+
+	if (sc->ptr != sizeof sc->buf)
+		return;
+	buf = sc->buf;
+	READ_STATE_BIG(sc);
+	first = (bcount == 0) << 7;
+	bcount ++;
+	UBI_BIG(96 + first, 0);
+	WRITE_STATE_BIG(sc);
+	sc->ptr = 0;
+}
+
 #if 0
 /* obsolete */
 static void
@@ -1231,6 +1257,13 @@ sph_skein512(void *cc, const void *data, size_t len)
 	skein_big_core(cc, data, len);
 }
 
+/* see sph_skein.h */
+void
+sph_skein512_midstate(void *cc)
+{
+	skein_big_midstate(cc);
+}
+
 /* see sph_skein.h */
 void
 sph_skein512_close(void *cc, void *dst)
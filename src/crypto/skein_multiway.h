@@ -0,0 +1,282 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SKEIN_MULTIWAY_H
+#define BITCOIN_CRYPTO_SKEIN_MULTIWAY_H
+
+// Multi-lane Skein-512 and SHA-256 for proof-of-work hashing, and the
+// double SHA-256 of 64-byte messages used for merkle trees.
+//
+// This header is only meant to be included by the per-instruction-set
+// translation units (hashskein_sse41.cpp, hashskein_avx2.cpp), after they
+// have defined their lane types. A 64-bit lane type V64 holds one word of
+// V64::WAYS independent messages and provides:
+//   static V64 Broadcast(uint64_t), static V64 Load(const uint64_t*),
+//   void Store(uint64_t*), operator+, operator^ and Rotl<n>(V64).
+// A 32-bit lane type V32 does the same for SHA-256 and additionally
+// provides operator&, operator| and Shr<n>(V32), Shl<n>(V32).
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+
+namespace skein_multiway
+{
+
+static const uint64_t IV512[8] = {
+    0x4903ADFF749C51CEull, 0x0D95DE399746DF03ull,
+    0x8FD1934127C79BCEull, 0x9A255629FF352CB1ull,
+    0x5DB62599DF6CA7B0ull, 0xEABE394CA9D5C3F4ull,
+    0x991112C71A75B523ull, 0xAE18A40B660FCC33ull
+};
+
+/** Tweak words for the three UBI invocations of an 80-byte Skein-512 hash. */
+static const uint64_t T_FIRST_0 = 64, T_FIRST_1 = (uint64_t)224 << 55;
+static const uint64_t T_FINAL_0 = 80, T_FINAL_1 = (uint64_t)352 << 55;
+static const uint64_t T_OUTPUT_0 = 8, T_OUTPUT_1 = (uint64_t)510 << 55;
+
+template<int r, typename V> void inline Mix(V& x0, V& x1)
+{
+    x0 = x0 + x1;
+    x1 = Rotl<r>(x1) ^ x0;
+}
+
+template<int r0, int r1, int r2, int r3, typename V>
+void inline Mix8(V& w0, V& w1, V& w2, V& w3, V& w4, V& w5, V& w6, V& w7)
+{
+    Mix<r0>(w0, w1);
+    Mix<r1>(w2, w3);
+    Mix<r2>(w4, w5);
+    Mix<r3>(w6, w7);
+}
+
+template<typename V>
+void inline AddKey(V* p, const V* k, const uint64_t* t, int s)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = p[i] + k[(s + i) % 9];
+    p[5] = p[5] + V::Broadcast(t[s % 3]);
+    p[6] = p[6] + V::Broadcast(t[(s + 1) % 3]);
+    p[7] = p[7] + V::Broadcast((uint64_t)s);
+}
+
+/** One UBI block: h = Threefish-512(key h, tweak t0/t1, message m) ^ m. */
+template<typename V>
+void UBI(V* h, const V* m, uint64_t t0, uint64_t t1)
+{
+    V k[9];
+    V p[8];
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+
+    k[8] = V::Broadcast(0x1BD11BDAA9FC1A22ull);
+    for (int i = 0; i < 8; i++) {
+        k[i] = h[i];
+        k[8] = k[8] ^ h[i];
+        p[i] = m[i];
+    }
+    for (int s = 0; s < 18; s += 2) {
+        AddKey(p, k, t, s);
+        Mix8<46, 36, 19, 37>(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+        Mix8<33, 27, 14, 42>(p[2], p[1], p[4], p[7], p[6], p[5], p[0], p[3]);
+        Mix8<17, 49, 36, 39>(p[4], p[1], p[6], p[3], p[0], p[5], p[2], p[7]);
+        Mix8<44,  9, 54, 56>(p[6], p[1], p[0], p[7], p[2], p[5], p[4], p[3]);
+        AddKey(p, k, t, s + 1);
+        Mix8<39, 30, 34, 24>(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+        Mix8<13, 50, 10, 17>(p[2], p[1], p[4], p[7], p[6], p[5], p[0], p[3]);
+        Mix8<25, 29, 39, 43>(p[4], p[1], p[6], p[3], p[0], p[5], p[2], p[7]);
+        Mix8< 8, 35, 56, 22>(p[6], p[1], p[0], p[7], p[2], p[5], p[4], p[3]);
+    }
+    AddKey(p, k, t, 18);
+    for (int i = 0; i < 8; i++)
+        h[i] = m[i] ^ p[i];
+}
+
+/** Load 64-bit little endian word `word` of each lane's message (stride bytes apart). */
+template<typename V>
+V inline LoadWord(const unsigned char* in, size_t stride, int word)
+{
+    uint64_t tmp[V::WAYS];
+    for (int j = 0; j < V::WAYS; j++)
+        tmp[j] = ReadLE64(in + j * stride + word * 8);
+    return V::Load(tmp);
+}
+
+/** Finish an 80-byte hash from chaining value h: final 16-byte block, then output. */
+template<typename V>
+void FinalizeTail(unsigned char* out, V* h, const unsigned char* tails, size_t stride)
+{
+    V m[8];
+    m[0] = LoadWord<V>(tails, stride, 0);
+    m[1] = LoadWord<V>(tails, stride, 1);
+    for (int i = 2; i < 8; i++)
+        m[i] = V::Broadcast(0);
+    UBI(h, m, T_FINAL_0, T_FINAL_1);
+
+    for (int i = 0; i < 8; i++)
+        m[i] = V::Broadcast(0);
+    UBI(h, m, T_OUTPUT_0, T_OUTPUT_1);
+
+    uint64_t tmp[V::WAYS];
+    for (int i = 0; i < 8; i++) {
+        h[i].Store(tmp);
+        for (int j = 0; j < V::WAYS; j++)
+            WriteLE64(out + j * 64 + i * 8, tmp[j]);
+    }
+}
+
+/** Skein-512 of V::WAYS consecutive 80-byte messages into V::WAYS * 64 bytes. */
+template<typename V>
+void Skein512_80(unsigned char* out, const unsigned char* in)
+{
+    V h[8];
+    V m[8];
+    for (int i = 0; i < 8; i++) {
+        h[i] = V::Broadcast(IV512[i]);
+        m[i] = LoadWord<V>(in, 80, i);
+    }
+    UBI(h, m, T_FIRST_0, T_FIRST_1);
+    FinalizeTail(out, h, in + 64, 80);
+}
+
+/** Skein-512 of V::WAYS 80-byte messages sharing a 64-byte prefix, given the
+ *  chaining value after that prefix and V::WAYS consecutive 16-byte tails. */
+template<typename V>
+void Skein512_Tail(unsigned char* out, const uint64_t* chain, const unsigned char* tails)
+{
+    V h[8];
+    for (int i = 0; i < 8; i++)
+        h[i] = V::Broadcast(chain[i]);
+    FinalizeTail(out, h, tails, 16);
+}
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t SHA256_IV[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul,
+    0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul
+};
+
+template<int n, typename V> V inline Rotr(V x) { return Shr<n>(x) | Shl<32 - n>(x); }
+template<typename V> V inline Ch(V x, V y, V z) { return z ^ (x & (y ^ z)); }
+template<typename V> V inline Maj(V x, V y, V z) { return (x & y) | (z & (x | y)); }
+template<typename V> V inline Sigma0(V x) { return Rotr<2>(x) ^ Rotr<13>(x) ^ Rotr<22>(x); }
+template<typename V> V inline Sigma1(V x) { return Rotr<6>(x) ^ Rotr<11>(x) ^ Rotr<25>(x); }
+template<typename V> V inline sigma0(V x) { return Rotr<7>(x) ^ Rotr<18>(x) ^ Shr<3>(x); }
+template<typename V> V inline sigma1(V x) { return Rotr<17>(x) ^ Rotr<19>(x) ^ Shr<10>(x); }
+
+/** SHA-256 compression of one block per lane (w is clobbered). */
+template<typename V>
+void Sha256Transform(V* s, V* w)
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        V wi;
+        if (i < 16) {
+            wi = w[i];
+        } else {
+            wi = w[i & 15] = w[i & 15] + sigma1(w[(i - 2) & 15]) + w[(i - 7) & 15] + sigma0(w[(i - 15) & 15]);
+        }
+        V t1 = h + Sigma1(e) + Ch(e, f, g) + V::Broadcast(K256[i]) + wi;
+        V t2 = Sigma0(a) + Maj(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s[0] = s[0] + a;
+    s[1] = s[1] + b;
+    s[2] = s[2] + c;
+    s[3] = s[3] + d;
+    s[4] = s[4] + e;
+    s[5] = s[5] + f;
+    s[6] = s[6] + g;
+    s[7] = s[7] + h;
+}
+
+/** Initialize the state and absorb V::WAYS consecutive 64-byte messages. */
+template<typename V>
+void Sha256Block64(V* s, const unsigned char* in)
+{
+    V w[16];
+    uint32_t tmp[V::WAYS];
+    for (int i = 0; i < 8; i++)
+        s[i] = V::Broadcast(SHA256_IV[i]);
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < V::WAYS; j++)
+            tmp[j] = ReadBE32(in + j * 64 + i * 4);
+        w[i] = V::Load(tmp);
+    }
+    Sha256Transform(s, w);
+}
+
+/** Absorb the padding block of a 64-byte message (length 512 bits). */
+template<typename V>
+void Sha256Pad64(V* s)
+{
+    V w[16];
+    w[0] = V::Broadcast(0x80000000ul);
+    for (int i = 1; i < 15; i++)
+        w[i] = V::Broadcast(0);
+    w[15] = V::Broadcast(512);
+    Sha256Transform(s, w);
+}
+
+template<typename V>
+void Sha256Store(unsigned char* out, const V* s)
+{
+    uint32_t tmp[V::WAYS];
+    for (int i = 0; i < 8; i++) {
+        s[i].Store(tmp);
+        for (int j = 0; j < V::WAYS; j++)
+            WriteBE32(out + j * 32 + i * 4, tmp[j]);
+    }
+}
+
+/** SHA-256 of V::WAYS consecutive 64-byte messages into V::WAYS * 32 bytes. */
+template<typename V>
+void Sha256_64(unsigned char* out, const unsigned char* in)
+{
+    V s[8];
+    Sha256Block64(s, in);
+    Sha256Pad64(s);
+    Sha256Store(out, s);
+}
+
+/** Double SHA-256 of V::WAYS consecutive 64-byte messages into V::WAYS * 32 bytes. */
+template<typename V>
+void Sha256D64(unsigned char* out, const unsigned char* in)
+{
+    V s[8], w[16];
+    Sha256Block64(s, in);
+    Sha256Pad64(s);
+
+    // The second hash is over the 32-byte digest, which fits one padded block.
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        s[i] = V::Broadcast(SHA256_IV[i]);
+    }
+    w[8] = V::Broadcast(0x80000000ul);
+    for (int i = 9; i < 15; i++)
+        w[i] = V::Broadcast(0);
+    w[15] = V::Broadcast(256);
+    Sha256Transform(s, w);
+    Sha256Store(out, s);
+}
+
+} // namespace skein_multiway
+
+#endif // BITCOIN_CRYPTO_SKEIN_MULTIWAY_H
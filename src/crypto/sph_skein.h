@@ -262,6 +262,17 @@ void sph_skein512_init(void *cc);
  */
 void sph_skein512(void *cc, const void *data, size_t len);
 
+/**
+ * Compress the buffered data if it forms a complete block, so that the
+ * context only holds the chaining value. This must only be called when
+ * at least one more byte will be processed before closing (the final
+ * block is processed differently). The resulting context can then be
+ * copied and reused for several messages sharing the same prefix.
+ *
+ * @param cc     the Skein-512 context
+ */
+void sph_skein512_midstate(void *cc);
+
 /**
  * Terminate the current Skein-512 computation and output the result into
  * the provided buffer. The destination buffer must be wide enough to
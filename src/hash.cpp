@@ -13,6 +13,16 @@ inline uint32_t ROTL32(uint32_t x, int8_t r)
     return (x << r) | (x >> (32 - r));
 }
 
+void MerkleHashLevel(uint256* out, const uint256* in, size_t nSize)
+{
+    // A uint256 is a plain 32-byte array, so each adjacent pair of hashes
+    // already forms one contiguous 64-byte message.
+    if (nSize >= 2)
+        SHA256D64(out[0].begin(), in[0].begin(), nSize / 2);
+    if (nSize & 1)
+        out[nSize / 2] = Hash(in[nSize - 1].begin(), in[nSize - 1].end(), in[nSize - 1].begin(), in[nSize - 1].end());
+}
+
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash)
 {
     // The following is MurmurHash3 (x86_32), see http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
@@ -159,6 +159,12 @@ uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL
     return ss.GetHash();
 }
 
+/** Compute one level of a merkle tree: out[i] = Hash(in[2i], in[2i+1]) for
+ *  the (nSize + 1) / 2 parents of nSize hashes, pairing the last hash with
+ *  itself when nSize is odd. Pairs are hashed in batches with SHA256D64.
+ */
+void MerkleHashLevel(uint256* out, const uint256* in, size_t nSize);
+
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
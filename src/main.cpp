@@ -8,11 +8,15 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockstorage.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/hashskein.h"
 #include "init.h"
+#include "mappedfile.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "pow.h"
@@ -27,8 +31,10 @@
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/function.hpp>
 #include <boost/math/distributions/poisson.hpp>
 #include <boost/thread.hpp>
 
@@ -50,6 +56,8 @@ CBlockIndex *pindexBestHeader = NULL;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
+uint256 hashBestChain;
+bool fInitialDownloadLatched = false;
 int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
@@ -59,7 +67,9 @@ bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = true;
+uint256 hashAssumeValid;
 size_t nCoinCacheUsage = 5000 * 300;
+CCoinsWriteStats coinsWriteStats;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
 
@@ -883,8 +893,8 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+static bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                       bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee, bool fOverrideMempoolLimit)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -941,26 +951,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx? Only the
+                // cache is consulted, to avoid disk lookups for every output.
+                for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, i)))
+                        return false;
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
             }
         }
 
-        // are the actual inputs available?
-        if (!view.HaveInputs(tx))
-            return state.Invalid(error("AcceptToMemoryPool: inputs already spent"),
-                                 REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
         // Bring the best block into scope
         view.GetBestBlock();
 
@@ -991,7 +997,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx));
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), nSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1001,8 +1007,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                       hash.ToString(), nFees, txMinFee),
                              REJECT_INSUFFICIENTFEE, "insufficient fee");
 
-        // Require that free transactions have sufficient priority to be mined in the next block.
-        if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
+        // Once the mempool has had to evict packages, require at least the
+        // fee rate of what was evicted (decaying back down over time).
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nFees < mempoolRejectFee) {
+            return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d",
+                                      hash.ToString(), nFees, mempoolRejectFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        } else if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
+            // Require that free transactions have sufficient priority to be mined in the next block.
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
         }
 
@@ -1035,9 +1048,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                          hash.ToString(),
                          nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+            return state.DoS(0, error("AcceptToMemoryPool: too long unconfirmed chain %s: %s", hash.ToString(), errString),
+                             REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        PrecomputedTransactionData txdata(tx);
+        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, &txdata))
         {
             return error("AcceptToMemoryPool: ConnectInputs failed %s", hash.ToString());
         }
@@ -1048,16 +1074,25 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // instance the STRICTENC flag was incorrectly allowing certain
         // CHECKSIG NOT scripts to pass, even though they were invalid.
         //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks, however allowing such transactions into the mempool
-        // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        // CreateNewBlock() relies on this: it no longer re-checks the inputs
+        // of mempool transactions and only catches invalid blocks through
+        // TestBlockValidity(). Allowing such transactions into the mempool
+        // can also be exploited as a DoS attack.
+        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, &txdata))
         {
             return error("AcceptToMemoryPool: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+        pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+
+        // trim mempool and check if tx was trimmed
+        if (!fOverrideMempoolLimit) {
+            pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+            if (!pool.exists(hash))
+                return state.DoS(0, error("AcceptToMemoryPool: mempool full, %s not kept", hash.ToString()),
+                                 REJECT_INSUFFICIENTFEE, "mempool full");
+        }
     }
 
     SyncWithWallets(tx, NULL);
@@ -1065,6 +1100,128 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectAbsurdFee, bool fOverrideMempoolLimit)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectAbsurdFee, fOverrideMempoolLimit);
+}
+
+static const char* MEMPOOL_FILENAME = "mempool.dat";
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+namespace {
+
+/** Parents are written before their children so that they load in order */
+struct CompareMempoolDumpOrder
+{
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return a->GetTime() < b->GetTime();
+    }
+};
+
+} // anon namespace
+
+bool LoadMempool()
+{
+    boost::filesystem::path path = GetDataDir() / MEMPOOL_FILENAME;
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    // Allowed to fail as this file IS missing on first startup.
+    if (filein.IsNull())
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nLoaded = 0, nFailed = 0, nAlreadyThere = 0;
+    try {
+        uint64_t nVersion;
+        filein >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s: unknown mempool file version %d", __func__, nVersion);
+
+        // Apply the prioritisations first so they count towards acceptance
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        filein >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); it++)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t nTransactions;
+        filein >> nTransactions;
+        for (uint64_t i = 0; i < nTransactions; i++) {
+            CTransaction tx;
+            int64_t nTime;
+            filein >> tx >> nTime;
+
+            CValidationState state;
+            LOCK(cs_main);
+            if (AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime, false, false))
+                nLoaded++;
+            else if (mempool.exists(tx.GetHash()))
+                nAlreadyThere++;
+            else
+                nFailed++;
+
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        return error("%s: failed to deserialize mempool data: %s", __func__, e.what());
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i already there (%dms)\n",
+              nLoaded, nFailed, nAlreadyThere, GetTimeMillis() - nStart);
+    return true;
+}
+
+void DumpMempool()
+{
+    int64_t nStart = GetTimeMillis();
+
+    // Copy what is needed under the lock, and write it out without holding it
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<std::pair<CTransaction, int64_t> > vEntries;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        std::vector<CTxMemPool::txiter> vSorted;
+        vSorted.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); it++)
+            vSorted.push_back(it);
+        std::sort(vSorted.begin(), vSorted.end(), CompareMempoolDumpOrder());
+        vEntries.reserve(vSorted.size());
+        BOOST_FOREACH(const CTxMemPool::txiter& it, vSorted)
+            vEntries.push_back(std::make_pair(it->GetTx(), it->GetTime()));
+    }
+
+    boost::filesystem::path path = GetDataDir() / MEMPOOL_FILENAME;
+    boost::filesystem::path pathTmp = GetDataDir() / (std::string(MEMPOOL_FILENAME) + ".new");
+    try {
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull()) {
+            LogPrintf("%s: Failed to write mempool to %s\n", __func__, pathTmp.string());
+            return;
+        }
+
+        fileout << MEMPOOL_DUMP_VERSION;
+        fileout << mapDeltas;
+        fileout << (uint64_t)vEntries.size();
+        for (size_t i = 0; i < vEntries.size(); i++)
+            fileout << vEntries[i].first << vEntries[i].second;
+
+        FileCommit(fileout.Get());
+        fileout.fclose();
+        if (!RenameOver(pathTmp, path)) {
+            LogPrintf("%s: Failed to rename %s\n", __func__, pathTmp.string());
+            return;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Failed to dump mempool: %s. Continuing anyway.\n", __func__, e.what());
+        return;
+    }
+    LogPrintf("Dumped %u mempool transactions to disk (%dms)\n", vEntries.size(), GetTimeMillis() - nStart);
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1102,10 +1259,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
-                CCoinsViewCache &view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -1159,18 +1315,63 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::M
     return true;
 }
 
+namespace {
+
+/** Number of block and undo files kept memory mapped for reading (fewer on 32 bit, to save address space) */
+static const size_t MAX_MAPPED_BLOCK_FILES = sizeof(void*) > 4 ? 16 : 2;
+
+CMappedFileCache mappedBlockFiles(MAX_MAPPED_BLOCK_FILES);
+
+/**
+ * Get a mapping of the blk or rev file holding the record (block or undo
+ * data) at pos, and set pbegin and pend to the record plus the nExtra bytes
+ * following it. Its size comes from the header written in front of it.
+ * Returns NULL if the file can't be mapped.
+ */
+boost::shared_ptr<const CMappedFile> MapDiskRecord(const CDiskBlockPos& pos, const char* prefix, unsigned int nExtra, const char*& pbegin, const char*& pend)
+{
+    boost::shared_ptr<const CMappedFile> pfile;
+    if (pos.IsNull() || pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return pfile;
+    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    pfile = mappedBlockFiles.Get(path, pos.nPos);
+    if (!pfile)
+        return pfile;
+    unsigned int nSize = ReadLE32((const unsigned char*)pfile->data() + pos.nPos - sizeof(nSize));
+    uint64_t nEnd = (uint64_t)pos.nPos + nSize + nExtra;
+    if (pfile->size() < nEnd) {
+        // The record was appended after the file was mapped. Let go of the
+        // old mapping first, as Remove() may be waiting for it.
+        pfile.reset();
+        pfile = mappedBlockFiles.Get(path, nEnd);
+        if (!pfile)
+            return pfile;
+    }
+    pbegin = pfile->data() + pos.nPos;
+    pend = pbegin + nSize + nExtra;
+    return pfile;
+}
+
+} // anon namespace
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
-    // Read block
+    // Read block, straight from a mapping of the file if possible
     try {
-        filein >> block;
+        const char *pbegin, *pend;
+        boost::shared_ptr<const CMappedFile> pfile = MapDiskRecord(pos, "blk", 0, pbegin, pend);
+        if (pfile) {
+            CMemoryReader filein(pbegin, pend, SER_DISK, CLIENT_VERSION);
+            filein >> block;
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1193,6 +1394,41 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex)
+{
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    CBlockHeader header;
+    try {
+        const char *pbegin, *pend;
+        boost::shared_ptr<const CMappedFile> pfile = MapDiskRecord(pos, "blk", 0, pbegin, pend);
+        if (pfile) {
+            vchBlock.assign(pbegin, pend);
+        } else {
+            // Read the size from the header in front of the block, then the block
+            if (pos.IsNull() || pos.nPos < sizeof(unsigned int))
+                return error("%s: Invalid position %s", __func__, pos.ToString());
+            CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(unsigned int)), true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+            unsigned int nSize;
+            filein >> nSize;
+            if (nSize > MAX_BLOCK_SIZE)
+                return error("%s: Invalid block size %u at %s", __func__, nSize, pos.ToString());
+            vchBlock.resize(nSize);
+            filein.read(begin_ptr(vchBlock), nSize);
+        }
+        CMemoryReader(begin_ptr(vchBlock), end_ptr(vchBlock), SER_DISK, CLIENT_VERSION) >> header;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    // Make sure these are the bytes of the block asked for
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("%s: GetHash() doesn't match index for %s at %s", __func__, pindex->ToString(), pos.ToString());
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1219,11 +1455,25 @@ bool IsInitialBlockDownload()
         return false;
     bool state = (chainActive.Height() < pindexBestHeader->nHeight - 24 * 6 ||
             pindexBestHeader->GetBlockTime() < GetTime() - 24 * 60 * 60);
-    if (!state)
+    if (!state) {
         lockIBDState = true;
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        fInitialDownloadLatched = true;
+    }
     return state;
 }
 
+bool IsAssumedValid(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValid.IsNull())
+        return false;
+    // The assumed valid block must also be in the best header chain we know of.
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    return it != mapBlockIndex.end() && it->second->GetAncestor(pindex->nHeight) == pindex &&
+           pindexBestHeader && pindexBestHeader->GetAncestor(pindex->nHeight) == pindex;
+}
+
 bool fLargeWorkForkFound = false;
 bool fLargeWorkInvalidChainFound = false;
 CBlockIndex *pindexBestForkTip = NULL, *pindexBestForkBase = NULL;
@@ -1362,25 +1612,16 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            Coin coin;
+            bool fSpent = inputs.SpendCoin(txin.prevout, &coin);
+            assert(fSpent);
+            txundo.vprevout.push_back(CTxInUndo(coin.out, coin.fCoinBase, coin.nHeight, coin.nVersion));
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight)
@@ -1391,13 +1632,13 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore, txdata), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, const PrecomputedTransactionData* txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
@@ -1418,20 +1659,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - (int)coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(
-                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight),
+                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - (int)coin.nHeight),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs(): txin values out of range"),
                                  REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
@@ -1462,11 +1703,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out.scriptPubKey, tx, i, flags, cacheStore, txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1478,8 +1719,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                        CScriptCheck check(coin.out.scriptPubKey, tx, i,
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, txdata);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -1530,16 +1771,23 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-
-    // Read block
+    // Read undo data and its checksum, straight from a mapping of the file if possible
     uint256 hashChecksum;
     try {
-        filein >> blockundo;
-        filein >> hashChecksum;
+        const char *pbegin, *pend;
+        boost::shared_ptr<const CMappedFile> pfile = MapDiskRecord(pos, "rev", sizeof(hashChecksum), pbegin, pend);
+        if (pfile) {
+            CMemoryReader filein(pbegin, pend, SER_DISK, CLIENT_VERSION);
+            filein >> blockundo;
+            filein >> hashChecksum;
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s: OpenBlockFile failed", __func__);
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -1586,24 +1834,23 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+
+    Coin coin(undo.txout, undo.nHeight, undo.fCoinBase, undo.nVersion);
+    if (undo.nHeight == 0) {
+        // Undo data written by older versions only carries the metadata for
+        // the last output of a transaction to be spent; it must then still be
+        // present on some other output of the same transaction.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        coin.nHeight = alternate.nHeight;
+        coin.fCoinBase = alternate.fCoinBase;
+        coin.nVersion = alternate.nVersion;
+    }
+    // When fClean is false, a coin already existed and this is an overwrite.
+    view.AddCoin(out, coin, !fClean);
 
     return fClean;
 }
@@ -1633,22 +1880,14 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
-        // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        // exactly, and remove them.
+        for (unsigned int o = 0; o < tx.vout.size(); o++) {
+            if (tx.vout[o].scriptPubKey.IsUnspendable())
+                continue;
+            Coin coin;
+            bool fSpent = view.SpendCoin(COutPoint(hash, o), &coin);
+            if (!fSpent || tx.vout[o] != coin.out || (unsigned int)pindex->nHeight != coin.nHeight || tx.IsCoinBase() != coin.fCoinBase)
+                fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
         }
 
         // restore inputs
@@ -1682,6 +1921,12 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    // Some systems can't truncate a file that is mapped.
+    if (fFinalize) {
+        mappedBlockFiles.Remove(GetBlockPosFilename(posOld, "blk"));
+        mappedBlockFiles.Remove(GetBlockPosFilename(posOld, "rev"));
+    }
+
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -1701,13 +1946,218 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+namespace {
+
+/** Number of consecutive headers whose proof of work is checked by one work unit. */
+static const size_t HEADER_CHECK_CHUNK_SIZE = 64;
+
+/** Closure representing the proof-of-work check of a run of consecutive headers. */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader* pheaders;
+    size_t nCount;
+
+public:
+    CHeaderCheck() : pheaders(NULL), nCount(0) {}
+    CHeaderCheck(const CBlockHeader* pheadersIn, size_t nCountIn) : pheaders(pheadersIn), nCount(nCountIn) {}
+
+    bool operator()()
+    {
+        // Copy the raw 80-byte headers next to each other so they can be hashed in one batch.
+        unsigned char vHeaders[HEADER_CHECK_CHUNK_SIZE * CSkeinHeaderMidstate::HEADER_SIZE];
+        unsigned char vHashes[HEADER_CHECK_CHUNK_SIZE * 32];
+        assert(nCount <= HEADER_CHECK_CHUNK_SIZE);
+        for (size_t i = 0; i < nCount; i++)
+            memcpy(&vHeaders[i * CSkeinHeaderMidstate::HEADER_SIZE], BEGIN(pheaders[i].nVersion), CSkeinHeaderMidstate::HEADER_SIZE);
+        HashSkeinHeaders(vHashes, vHeaders, nCount);
+
+        for (size_t i = 0; i < nCount; i++) {
+            uint256 hash;
+            memcpy(hash.begin(), &vHashes[i * 32], 32);
+            if (!CheckProofOfWork(hash, pheaders[i].nBits, Params().GetConsensus()))
+                return false;
+        }
+        return true;
+    }
+
+    void swap(CHeaderCheck& check)
+    {
+        std::swap(pheaders, check.pheaders);
+        std::swap(nCount, check.nCount);
+    }
+};
+
+/** Number of outpoints looked up by one input prefetch work unit. */
+static const size_t PREFETCH_CHUNK_SIZE = 16;
+
+/**
+ * Closure reading the coins of a run of outpoints from a view that is safe to
+ * read from several threads at once (the database), into a result array.
+ * Outpoints that are not found get a spent coin.
+ */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView* pview;
+    const COutPoint* poutpoints;
+    Coin* pcoins;
+    size_t nCount;
+
+public:
+    CCoinsPrefetch() : pview(NULL), poutpoints(NULL), pcoins(NULL), nCount(0) {}
+    CCoinsPrefetch(const CCoinsView* pviewIn, const COutPoint* poutpointsIn, Coin* pcoinsIn, size_t nCountIn) :
+        pview(pviewIn), poutpoints(poutpointsIn), pcoins(pcoinsIn), nCount(nCountIn) {}
+
+    bool operator()()
+    {
+        try {
+            for (size_t i = 0; i < nCount; i++) {
+                if (!pview->GetCoin(poutpoints[i], pcoins[i]))
+                    pcoins[i].Clear();
+            }
+        } catch (const std::exception& e) {
+            // Database read errors never get here: the error catcher behind
+            // pcoinsTip aborts the node on them, as it would during
+            // ConnectBlock. Anything else leaves these coins unread, so
+            // ConnectBlock looks them up itself.
+            for (size_t i = 0; i < nCount; i++)
+                pcoins[i].Clear();
+            return false;
+        }
+        return true;
+    }
+
+    void swap(CCoinsPrefetch& check)
+    {
+        std::swap(pview, check.pview);
+        std::swap(poutpoints, check.poutpoints);
+        std::swap(pcoins, check.pcoins);
+        std::swap(nCount, check.nCount);
+    }
+};
+
+/**
+ * A unit of work for the -par worker threads: a script check, the
+ * proof-of-work check of a run of headers, or an input prefetch. All kinds
+ * share one queue so a single set of threads serves them.
+ */
+class CValidationCheck
+{
+private:
+    enum Type { NONE, SCRIPT, HEADERS, PREFETCH };
+
+    Type type;
+    CScriptCheck script;
+    CHeaderCheck headers;
+    CCoinsPrefetch prefetch;
+
+public:
+    CValidationCheck() : type(NONE) {}
+    explicit CValidationCheck(CScriptCheck& check) : type(SCRIPT) { script.swap(check); }
+    explicit CValidationCheck(CHeaderCheck& check) : type(HEADERS) { headers.swap(check); }
+    explicit CValidationCheck(CCoinsPrefetch& check) : type(PREFETCH) { prefetch.swap(check); }
+
+    bool operator()()
+    {
+        switch (type) {
+        case SCRIPT:
+            return script();
+        case HEADERS:
+            return headers();
+        case PREFETCH:
+            return prefetch();
+        default:
+            return true;
+        }
+    }
+
+    void swap(CValidationCheck& check)
+    {
+        std::swap(type, check.type);
+        script.swap(check.script);
+        headers.swap(check.headers);
+        prefetch.swap(check.prefetch);
+    }
+};
+
+CCheckQueue<CValidationCheck> scriptcheckqueue(128);
+
+/** Move a batch of checks of one kind onto the shared validation queue. */
+template <typename T>
+void AddValidationChecks(CCheckQueueControl<CValidationCheck>& control, std::vector<T>& vChecks)
+{
+    std::vector<CValidationCheck> vValidationChecks(vChecks.size());
+    for (size_t i = 0; i < vChecks.size(); i++)
+        CValidationCheck(vChecks[i]).swap(vValidationChecks[i]);
+    control.Add(vValidationChecks);
+}
+
+/**
+ * Read the coins spent by a block that are not in pcoinsTip yet from the
+ * database, using the worker threads, and add them to pcoinsTip. Connecting
+ * the block afterwards then only has to look in memory, instead of doing one
+ * database read after another. Returns the number of coins read.
+ */
+size_t PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    // Without worker threads this would just do the same reads a bit earlier.
+    if (!nScriptCheckThreads)
+        return 0;
+
+    std::set<uint256> setBlockTxids;
+    std::vector<COutPoint> vOutPoints;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                // Outputs created earlier in this block can't be on disk.
+                if (!setBlockTxids.count(txin.prevout.hash) && !pcoinsTip->HaveCoinInCache(txin.prevout))
+                    vOutPoints.push_back(txin.prevout);
+            }
+        }
+        setBlockTxids.insert(tx.GetHash());
+    }
+    if (vOutPoints.empty())
+        return 0;
+
+    std::vector<Coin> vCoins(vOutPoints.size());
+    {
+        CCheckQueueControl<CValidationCheck> control(&scriptcheckqueue);
+        std::vector<CCoinsPrefetch> vChecks;
+        for (size_t i = 0; i < vOutPoints.size(); i += PREFETCH_CHUNK_SIZE) {
+            vChecks.push_back(CCoinsPrefetch());
+            CCoinsPrefetch(pcoinsTip->GetBackend(), &vOutPoints[i], &vCoins[i],
+                           std::min(PREFETCH_CHUNK_SIZE, vOutPoints.size() - i)).swap(vChecks.back());
+        }
+        AddValidationChecks(control, vChecks);
+        control.Wait();
+    }
+
+    size_t nRead = 0;
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        if (!vCoins[i].IsSpent() && pcoinsTip->EmplaceCoinFromBase(vOutPoints[i], vCoins[i]))
+            nRead++;
+    }
+    return nRead;
+}
+
+CBlockReadAhead blockreadahead;
+
+CRecentBlocks recentBlocks;
+
+} // anon namespace
 
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+void ThreadBlockReadAhead() {
+    RenameThread("bitcoin-blockread");
+    blockreadahead.Thread();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -1797,6 +2247,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     bool fScriptChecks = (!fCheckpointsEnabled || pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate(chainparams.Checkpoints()));
+    // All other checks (amounts, spent coins, proof of work) are still done
+    // for assumed valid blocks; only the signatures are assumed to be right.
+    if (fScriptChecks && IsAssumedValid(pindex))
+        fScriptChecks = false;
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -1815,10 +2269,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                            (pindex->nHeight==91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (unsigned int o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
@@ -1835,7 +2290,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    // Signature hash data shared by the script checks of each transaction. Reserved up front so the
+    // queued checks' pointers into it stay valid, and declared first so it outlives the queue control.
+    std::vector<PrecomputedTransactionData> txdata;
+    if (fScriptChecks)
+        txdata.reserve(block.vtx.size());
+    CCheckQueueControl<CValidationCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -1875,9 +2335,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
             std::vector<CScriptCheck> vChecks;
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
+            const PrecomputedTransactionData* ptxdata = NULL;
+            if (fScriptChecks) {
+                txdata.push_back(PrecomputedTransactionData(tx));
+                ptxdata = &txdata.back();
+            }
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, ptxdata, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
-            control.Add(vChecks);
+            AddValidationChecks(control, vChecks);
         }
 
         CTxUndo undoDummy;
@@ -1991,10 +2456,21 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         nLastSetChain = nNow;
     }
     size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    size_t cacheTrimTarget = nCoinCacheUsage / 100 * COINS_CACHE_TRIM_PERCENT;
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
-    // The cache is over the limit, we have to write now.
+    // The cache is over the limit, we have to make room now.
     bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCoinCacheUsage;
+    if (fCacheLarge || fCacheCritical) {
+        // Evicting entries that are already on disk is cheap; only write if
+        // the cache is still too large after that, i.e. it is mostly dirty.
+        size_t nEvicted = pcoinsTip->Trim(cacheTrimTarget);
+        LogPrint("coindb", "Evicted %u clean coins cache entries (%.1fMiB -> %.1fMiB)\n", (unsigned int)nEvicted,
+                 cacheSize * (1.0 / 1024 / 1024), pcoinsTip->DynamicMemoryUsage() * (1.0 / 1024 / 1024));
+        cacheSize = pcoinsTip->DynamicMemoryUsage();
+        fCacheLarge = fCacheLarge && cacheSize * (10.0/9) > nCoinCacheUsage;
+        fCacheCritical = fCacheCritical && cacheSize > nCoinCacheUsage;
+    }
     // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
@@ -2033,16 +2509,29 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        // Only dirty entries get written; clean ones are already on disk.
+        CCoinsCacheStats cacheStats;
+        pcoinsTip->GetCacheStats(cacheStats);
+        if (!CheckDiskSpace(48 * 2 * 2 * cacheStats.nDirtyEntries))
             return state.Error("out of disk space");
-        // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Write the chainstate (which may refer to block index entries). Clean
+        // entries stay cached; only trim them if we are short on memory.
+        int64_t nWriteStart = GetTimeMicros();
+        if (!pcoinsTip->Sync())
             return AbortNode(state, "Failed to write to coin database");
+        int64_t nWriteMicros = GetTimeMicros() - nWriteStart;
+        coinsWriteStats.nWrites++;
+        coinsWriteStats.nLastWriteTime = nNow / 1000000;
+        coinsWriteStats.nLastWriteMicros = nWriteMicros;
+        coinsWriteStats.nTotalWriteMicros += nWriteMicros;
+        LogPrint("coindb", "Wrote coins cache to disk in %.2fms\n", nWriteMicros * 0.001);
+        if (fCacheLarge || fCacheCritical)
+            pcoinsTip->Trim(cacheTrimTarget);
         nLastFlush = nNow;
     }
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
@@ -2075,6 +2564,10 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     // New best block
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        hashBestChain = pindexNew->GetBlockHash();
+    }
 
     LogPrintf("%s: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n", __func__,
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
@@ -2129,13 +2622,22 @@ bool static DisconnectTip(CValidationState &state) {
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    std::vector<uint256> vHashUpdate;
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, false, true))
             mempool.remove(tx, removed, true);
-    }
+        else if (mempool.exists(tx.GetHash()))
+            vHashUpdate.push_back(tx.GetHash());
+    }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in this
+    // block that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
     mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
@@ -2149,6 +2651,7 @@ bool static DisconnectTip(CValidationState &state) {
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2163,16 +2666,22 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     mempool.check(pcoinsTip);
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
-    CBlock block;
+    boost::shared_ptr<CBlock> pblockRead;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
+        pblockRead = blockreadahead.Read(pindexNew);
+        if (!pblockRead)
             return AbortNode(state, "Failed to read block");
-        pblock = &block;
+        pblock = pblockRead.get();
     }
-    // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    // Warm the coins cache with the block's inputs.
+    size_t nPrefetched = PrefetchBlockInputs(*pblock);
+    int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+    LogPrint("bench", "  - Prefetch inputs: %.2fms (%u cache misses) [%.2fs]\n", (nTimePrefetched - nTime2) * 0.001, (unsigned int)nPrefetched, nTimePrefetch * 0.000001);
+    nTime2 = nTimePrefetched;
+    // Apply the block atomically to the chain state.
     {
         CCoinsViewCache view(pcoinsTip);
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
@@ -2201,6 +2710,10 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    // Keep new blocks at hand for relaying them; there is nobody to relay
+    // to while catching up.
+    if (!IsInitialBlockDownload())
+        recentBlocks.Add(pblockRead ? pblockRead : boost::shared_ptr<const CBlock>(new CBlock(*pblock)));
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
@@ -2298,9 +2811,11 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
     // Disconnect active blocks which are no longer in the best chain.
+    bool fBlocksDisconnected = false;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
         if (!DisconnectTip(state))
             return false;
+        fBlocksDisconnected = true;
     }
 
     // Build list of new blocks to connect.
@@ -2322,6 +2837,17 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
 
     // Connect new blocks.
     BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
+        // Have this block and the ones following it read from disk in the
+        // background, so the next reads overlap with connecting this one.
+        std::vector<const CBlockIndex*> vpindexReadAhead;
+        int nReadAheadHeight = std::min(pindexConnect->nHeight + (int)BLOCK_READ_AHEAD, pindexMostWork->nHeight);
+        for (int nReadHeight = pindexConnect->nHeight; nReadHeight <= nReadAheadHeight; nReadHeight++) {
+            const CBlockIndex* pindexRead = pindexMostWork->GetAncestor(nReadHeight);
+            if (pindexRead == pindexMostWork && pblock)
+                break;
+            vpindexReadAhead.push_back(pindexRead);
+        }
+        blockreadahead.Request(vpindexReadAhead);
         if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
             if (state.IsInvalid()) {
                 // The block violates a consensus rule.
@@ -2329,6 +2855,7 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
                     InvalidChainFound(vpindexToConnect.back());
                 state = CValidationState();
                 fInvalidFound = true;
+                blockreadahead.Request(std::vector<const CBlockIndex*>());
                 fContinue = false;
                 break;
             } else {
@@ -2346,6 +2873,11 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     }
     }
 
+    // Transactions from disconnected blocks were let back in regardless of
+    // -maxmempool; trim now that the reorg is done.
+    if (fBlocksDisconnected)
+        mempool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+
     // Callbacks/notifications for a new best chain.
     if (fInvalidFound)
         CheckForkWarningConditionsOnNewFork(vpindexToConnect.back());
@@ -2658,6 +3190,28 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
+bool CheckBlockHeadersPoW(const std::vector<CBlockHeader>& headers, CValidationState& state)
+{
+    // This runs without cs_main; the control waits for a block being connected to finish its script checks.
+    CCheckQueueControl<CValidationCheck> control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    bool fOk = true;
+    std::vector<CHeaderCheck> vChecks;
+    for (size_t i = 0; i < headers.size() && fOk; i += HEADER_CHECK_CHUNK_SIZE) {
+        CHeaderCheck check(&headers[i], std::min(HEADER_CHECK_CHUNK_SIZE, headers.size() - i));
+        if (nScriptCheckThreads) {
+            vChecks.push_back(CHeaderCheck());
+            check.swap(vChecks.back());
+        } else {
+            fOk = check();
+        }
+    }
+    AddValidationChecks(control, vChecks);
+    if (!control.Wait() || !fOk)
+        return state.DoS(50, error("CheckBlockHeadersPoW(): proof of work failed"),
+                         REJECT_INVALID, "high-hash");
+    return true;
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -2791,7 +3345,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckPOW)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
@@ -2809,7 +3363,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
     // Get prev block index
@@ -3010,6 +3564,9 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        // Deleting a mapped file fails on Windows; wait for readers to let go.
+        mappedBlockFiles.Remove(GetBlockPosFilename(pos, "blk"));
+        mappedBlockFiles.Remove(GetBlockPosFilename(pos, "rev"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3230,6 +3787,10 @@ bool static LoadBlockIndexDB()
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        hashBestChain = it->second->GetBlockHash();
+    }
 
     PruneBlockIndexCandidates();
 
@@ -3334,6 +3895,10 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        hashBestChain.SetNull();
+    }
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
@@ -3409,101 +3974,90 @@ bool InitBlockIndex() {
 
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
-{
-    const CChainParams& chainparams = Params();
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+namespace {
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+/** Map of disk positions for blocks with unknown parent (only used for reindex) */
+std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+/**
+ * Process a block read from a block file, and the earlier encountered blocks
+ * that were waiting for it. Blocks whose parent is unknown are put aside
+ * until it shows up. Returns false on a system error.
+ */
+bool ImportBlock(CBlock& block, const uint256& hash, CDiskBlockPos* dbp, int& nLoaded)
+{
+    const CChainParams& chainparams = Params();
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, true, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+    // detect out of order blocks, and store them for later
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second))
-                        {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, true, &it->second))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                    }
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        CValidationState state;
+        if (ProcessNewBlock(state, NULL, &block, true, dbp))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    CBlock blockChild;
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            if (ReadBlockFromDisk(blockChild, it->second))
+            {
+                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
+                        head.ToString());
+                CValidationState dummy;
+                if (ProcessNewBlock(dummy, NULL, &blockChild, true, &it->second))
+                {
+                    nLoaded++;
+                    queue.push_back(blockChild.GetHash());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s", __func__, e.what());
             }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
         }
+    }
+    return true;
+}
+
+/** ScanBlockFile callback importing blocks right away. */
+bool ImportScannedBlock(const boost::shared_ptr<CBlock>& pblock, const uint256& hash, CDiskBlockPos* dbp, int* pnLoaded)
+{
+    try {
+        return ImportBlock(*pblock, hash, dbp, *pnLoaded);
+    } catch (const std::exception& e) {
+        // Like a deserialization error, this only skips the block.
+        LogPrintf("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+} // anon namespace
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    try {
+        // The block's size, passed as the fourth argument, is not needed here.
+        ScanBlockFile(fileIn, dbp, boost::bind(&ImportScannedBlock, _1, _2, _3, &nLoaded));
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -3512,6 +4066,50 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
     return nLoaded > 0;
 }
 
+void ReindexBlockFiles()
+{
+    int64_t nStart = GetTimeMillis();
+    int nFiles = 0;
+    while (boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nFiles, 0), "blk")))
+        nFiles++;
+
+    int nThreads = std::max(1, std::min(nScriptCheckThreads, MAX_REINDEX_SCAN_THREADS));
+    LogPrintf("Reindexing %d block files using %d threads\n", nFiles, nThreads);
+    CReindexScanner scanner(nFiles, nThreads);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CReindexScanner::Thread, &scanner));
+
+    int nLoaded = 0;
+    try {
+        uiInterface.ShowProgress(_("Reindexing blocks..."), 0);
+        for (int nFile = 0; nFile < nFiles; nFile++) {
+            LogPrintf("Reindexing block file blk%05u.dat (%d%%)...\n", (unsigned int)nFile, nFile * 100 / nFiles);
+            CReindexScanner::CScannedBlock scanned;
+            bool fSkip = false;
+            while (scanner.Next(nFile, scanned)) {
+                boost::this_thread::interruption_point();
+                // After a system error the rest of the file is skipped, like LoadExternalBlockFile does.
+                if (!fSkip)
+                    fSkip = !ImportScannedBlock(scanned.pblock, scanned.hash, &scanned.pos, &nLoaded);
+            }
+            uiInterface.ShowProgress(_("Reindexing blocks..."), std::min(99, (nFile + 1) * 100 / nFiles));
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    } catch (...) {
+        scanner.Stop();
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+        uiInterface.ShowProgress("", 100);
+        throw;
+    }
+    scanner.Stop();
+    threadGroup.join_all();
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("Reindexed %d blocks from %d block files in %dms\n", nLoaded, nFiles, GetTimeMillis() - nStart);
+}
+
 void static CheckBlockIndex()
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -3775,8 +4373,11 @@ bool static AlreadyHave(const CInv& inv)
         {
             bool txInMap = false;
             txInMap = mempool.exists(inv.hash);
+            // Only the first two outputs are checked, and only in the cache:
+            // this is a cheap filter, not an exact answer.
             return txInMap || mapOrphanTransactions.count(inv.hash) ||
-                pcoinsTip->HaveCoins(inv.hash);
+                pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+                pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -3828,14 +4429,28 @@ void static ProcessGetData(CNode* pfrom)
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
+                    // Send block from memory if it is a recent one, or else from disk
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        boost::shared_ptr<const std::vector<char> > pvchRecent = recentBlocks.GetSerialized(inv.hash);
+                        if (pvchRecent) {
+                            pfrom->PushMessage("block", CFlatData(*pvchRecent));
+                        } else {
+                            // Pass on the bytes as stored, rather than deserializing
+                            // the block only to serialize it again.
+                            std::vector<char> vchBlock;
+                            if (!ReadRawBlockFromDisk(vchBlock, (*mi).second))
+                                assert(!"cannot load block from disk");
+                            pfrom->PushMessage("block", CFlatData(vchBlock));
+                        }
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        boost::shared_ptr<const CBlock> pblockRecent = recentBlocks.Get(inv.hash);
+                        CBlock blockRead;
+                        if (!pblockRecent && !ReadBlockFromDisk(blockRead, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        const CBlock& block = pblockRecent ? *pblockRecent : blockRead;
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -4429,6 +5044,19 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Proof of work is context-independent, check all of it before taking cs_main.
+        {
+            CValidationState state;
+            if (!CheckBlockHeadersPoW(headers, state)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && nDoS > 0) {
+                    LOCK(cs_main);
+                    Misbehaving(pfrom->GetId(), nDoS);
+                }
+                return error("invalid header received");
+            }
+        }
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -4443,7 +5071,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, false)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
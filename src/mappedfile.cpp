@@ -0,0 +1,101 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#include "utiltime.h"
+
+#include <exception>
+
+#include <boost/filesystem/operations.hpp>
+
+CMappedFile::CMappedFile(const boost::filesystem::path& path) :
+    mapping(path.string().c_str(), boost::interprocess::read_only),
+    region(mapping, boost::interprocess::read_only)
+{
+}
+
+CMappedFileCache::CMappedFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn)
+{
+}
+
+boost::shared_ptr<const CMappedFile> CMappedFileCache::Get(const boost::filesystem::path& path, uint64_t nEnd)
+{
+    LOCK(cs);
+    // Check the file as it is now: reading a part of a mapping that the file
+    // no longer has raises SIGBUS rather than an error.
+    boost::system::error_code ec;
+    uint64_t nFileSize = boost::filesystem::file_size(path, ec);
+    for (FileList::iterator it = listFiles.begin(); it != listFiles.end(); it++) {
+        if (it->first != path)
+            continue;
+        if (!ec && it->second->size() <= nFileSize && it->second->size() >= nEnd) {
+            listFiles.splice(listFiles.begin(), listFiles, it);
+            return listFiles.front().second;
+        }
+        // The file has grown, shrunk or gone since it was mapped.
+        Drop(it);
+        break;
+    }
+    if (ec || nFileSize < nEnd)
+        return boost::shared_ptr<const CMappedFile>();
+
+    boost::shared_ptr<const CMappedFile> pfile;
+    try {
+        pfile.reset(new CMappedFile(path));
+    } catch (const std::exception&) {
+        // Missing or empty files can't be mapped; callers fall back to reading
+        // the file, which reports errors properly.
+        return boost::shared_ptr<const CMappedFile>();
+    }
+    if (pfile->size() < nEnd)
+        return boost::shared_ptr<const CMappedFile>();
+
+    listFiles.push_front(std::make_pair(path, pfile));
+    if (listFiles.size() > nMaxFiles)
+        Drop(--listFiles.end());
+    return pfile;
+}
+
+void CMappedFileCache::Drop(FileList::iterator it)
+{
+    AssertLockHeld(cs);
+    for (DroppedList::iterator itDropped = listDropped.begin(); itDropped != listDropped.end(); ) {
+        if (itDropped->second.expired())
+            itDropped = listDropped.erase(itDropped);
+        else
+            itDropped++;
+    }
+    listDropped.push_back(std::make_pair(it->first, boost::weak_ptr<const CMappedFile>(it->second)));
+    listFiles.erase(it);
+}
+
+void CMappedFileCache::Remove(const boost::filesystem::path& path)
+{
+    LOCK(cs);
+    for (FileList::iterator it = listFiles.begin(); it != listFiles.end(); it++) {
+        if (it->first == path) {
+            Drop(it);
+            break;
+        }
+    }
+    // Wait for other threads to finish reading from any mapping of the file.
+    // Holding cs keeps them from mapping it again in the meantime.
+    for (DroppedList::iterator it = listDropped.begin(); it != listDropped.end(); ) {
+        if (it->first != path) {
+            it++;
+            continue;
+        }
+        while (!it->second.expired())
+            MilliSleep(1);
+        it = listDropped.erase(it);
+    }
+}
+
+void CMappedFileCache::Clear()
+{
+    LOCK(cs);
+    while (!listFiles.empty())
+        Drop(listFiles.begin());
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include "sync.h"
+
+#include <list>
+#include <stdint.h>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+/** A read-only memory mapping of a whole file. */
+class CMappedFile : private boost::noncopyable
+{
+private:
+    boost::interprocess::file_mapping mapping;
+    boost::interprocess::mapped_region region;
+
+public:
+    //! Map the file as it is now. Throws if it cannot be mapped, e.g. when it is empty.
+    explicit CMappedFile(const boost::filesystem::path& path);
+
+    const char* data() const { return static_cast<const char*>(region.get_address()); }
+    size_t size() const { return region.get_size(); }
+};
+
+/**
+ * Keeps the most recently used files mapped, so reading records from them
+ * (like blocks from blk?????.dat files) does not have to open, seek and read
+ * the file every time.
+ *
+ * Files that are still being appended to are mapped again once a record
+ * beyond the end of their mapping is asked for. A mapping handed out stays
+ * valid for as long as the caller holds on to it, even when the cache has
+ * dropped it already.
+ */
+class CMappedFileCache
+{
+private:
+    typedef std::list<std::pair<boost::filesystem::path, boost::shared_ptr<const CMappedFile> > > FileList;
+    typedef std::list<std::pair<boost::filesystem::path, boost::weak_ptr<const CMappedFile> > > DroppedList;
+
+    CCriticalSection cs;
+    //! Mapped files, most recently used first.
+    FileList listFiles;
+    //! Mappings no longer in listFiles that callers may still be reading from.
+    DroppedList listDropped;
+    const size_t nMaxFiles;
+
+    //! Move a mapping from listFiles to listDropped.
+    void Drop(FileList::iterator it);
+
+public:
+    explicit CMappedFileCache(size_t nMaxFilesIn);
+
+    /**
+     * Get a mapping of path that covers at least its first nEnd bytes, and no
+     * more than the file has now. Returns NULL if the file is shorter or
+     * cannot be mapped.
+     */
+    boost::shared_ptr<const CMappedFile> Get(const boost::filesystem::path& path, uint64_t nEnd);
+
+    /**
+     * Drop the mapping of path and wait until no other thread holds it, e.g.
+     * before the file is truncated or deleted. The caller must not hold a
+     * mapping of path itself.
+     */
+    void Remove(const boost::filesystem::path& path);
+
+    //! Drop all mappings.
+    void Clear();
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
@@ -5,6 +5,8 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "support/allocators/pool.h"
+
 #include <stdlib.h>
 
 #include <map>
@@ -28,10 +30,12 @@ static size_t MallocUsage(size_t alloc);
  *  do the recursion themselves, or use more efficient caching + updating on modification.
  */
 template<typename X> static size_t DynamicUsage(const std::vector<X>& v);
-template<typename X> static size_t DynamicUsage(const std::set<X>& s);
-template<typename X, typename Y> static size_t DynamicUsage(const std::map<X, Y>& m);
+template<typename X, typename Y> static size_t DynamicUsage(const std::set<X, Y>& s);
+template<typename X, typename Y, typename Z> static size_t DynamicUsage(const std::map<X, Y, Z>& m);
 template<typename X, typename Y> static size_t DynamicUsage(const boost::unordered_set<X, Y>& s);
 template<typename X, typename Y, typename Z> static size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& s);
+template<typename X, typename Y, typename Z, typename P, size_t M, size_t A>
+static size_t DynamicUsage(const boost::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, M, A> >& m);
 template<typename X> static size_t DynamicUsage(const X& x);
 
 static inline size_t MallocUsage(size_t alloc)
@@ -65,18 +69,31 @@ static inline size_t DynamicUsage(const std::vector<X>& v)
     return MallocUsage(v.capacity() * sizeof(X));
 }
 
-template<typename X>
-static inline size_t DynamicUsage(const std::set<X>& s)
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::set<X, Y>& s)
 {
     return MallocUsage(sizeof(stl_tree_node<X>)) * s.size();
 }
 
+/** Memory used by a single additional element of a set (or map) */
 template<typename X, typename Y>
-static inline size_t DynamicUsage(const std::map<X, Y>& m)
+static inline size_t IncrementalDynamicUsage(const std::set<X, Y>& s)
+{
+    return MallocUsage(sizeof(stl_tree_node<X>));
+}
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::map<X, Y, Z>& m)
 {
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
 }
 
+template<typename X, typename Y, typename Z>
+static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
+}
+
 // Boost data structures
 
 template<typename X>
@@ -98,6 +115,15 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+//! A pool allocated map is charged for the nodes and bucket array it holds from its resource.
+//! Freed nodes the resource keeps for reuse are not counted; the map's owner has to
+//! give those back (see PoolResource::Release).
+template<typename X, typename Y, typename Z, typename P, size_t M, size_t A>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, M, A> >& m)
+{
+    return m.get_allocator().GetResource()->BytesInUse();
+}
+
 // Dispatch to class method as fallback
 
 template<typename X>
@@ -64,17 +64,19 @@ uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::ve
     if (height == 0) {
         // hash at height 0 is the txids themself
         return vTxid[pos];
-    } else {
-        // calculate left hash
-        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
-        // calculate right hash if not beyond the end of the array - copy left hash otherwise1
-        if (pos*2+1 < CalcTreeWidth(height-1))
-            right = CalcHash(height-1, pos*2+1, vTxid);
-        else
-            right = left;
-        // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
     }
+    // Hash the subtree level by level rather than recursively, so that each
+    // level's pairs can be hashed in batches. Trailing odd nodes are paired
+    // with themselves, exactly as the whole tree does at its right edge.
+    size_t nBegin = (size_t)pos << height;
+    size_t nEnd = std::min(((size_t)pos + 1) << height, vTxid.size());
+    std::vector<uint256> vHashes(vTxid.begin() + nBegin, vTxid.begin() + nEnd), vParents;
+    for (int h = 0; h < height; h++) {
+        vParents.resize((vHashes.size() + 1) / 2);
+        MerkleHashLevel(&vParents[0], &vHashes[0], vHashes.size());
+        vHashes.swap(vParents);
+    }
+    return vHashes[0];
 }
 
 void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) {
@@ -9,20 +9,25 @@
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/hashskein.h"
 #include "hash.h"
 #include "main.h"
 #include "net.h"
 #include "pow.h"
 #include "primitives/transaction.h"
 #include "timedata.h"
+#include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #endif
 
+#include <algorithm>
+#include <limits>
+
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 
@@ -33,294 +38,566 @@ using namespace std;
 
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. Block assembly walks the mempool's
+// ancestor score index, so every transaction is considered together with the
+// unconfirmed ancestors it needs (its "package"). Once part of a package is in
+// the block, the remaining descendants are re-scored in mapModifiedTx without
+// the ancestors that were already included.
 //
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
-{
-    bool byFee;
+namespace {
 
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+struct update_for_parent_inclusion
+{
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator() (CTxMemPoolModifiedEntry &e)
     {
-        if (byFee)
-        {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpsWithAncestors -= iter->GetSigOpCount();
     }
+
+    CTxMemPool::txiter iter;
 };
 
-void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
-{
-    pblock->nTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
+/** Sort a package so that parents come before their children. */
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
 
-    // Updating time can change work required on testnet:
-    if (consensusParams.fPowAllowMinDifficultyBlocks)
-        pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, consensusParams);
-}
+// We want to sort transactions by coin age priority
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
 
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+struct TxCoinAgePriorityCompare
 {
-    const CChainParams& chainparams = Params();
-    // Create new block
-    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-
-    // -regtest only: allow overriding block.nVersion with
-    // -blockversion=N to test forking scenarios
-    if (Params().MineBlocksOnDemand())
-        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b) const
+    {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByScore()(*(b.second), *(a.second)); //Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
 
-    // Create coinbase tx
-    CMutableTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
-    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+} // anon namespace
 
+void CBlockAssembler::Reset()
+{
+    blocktemplate = CBlockTemplate();
     // Add dummy coinbase tx as first transaction
     pblock->vtx.push_back(CTransaction());
-    pblocktemplate->vTxFees.push_back(-1); // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+    pblocktemplate->vTxFees.push_back(-1); // updated by CreateNewBlock
+    pblocktemplate->vTxSigOps.push_back(-1); // updated by CreateNewBlock
 
     // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
     // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
     nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
 
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
     nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
 
     // Minimum block size you want to create; block will be filled with free transactions
     // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
     nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
 
-    // Collect memory pool transactions into the block
-    CAmount nFees = 0;
+    nBlockSize = 1000;
+    nBlockTx = 0;
+    nBlockSigOps = 100;
+    nFees = 0;
+    inBlock.clear();
+    fPrintPriority = GetBoolArg("-printpriority", false);
+
+    vPendingAdds.clear();
+    fNeedRebuild = false;
+    feeRateWorst = CFeeRate(std::numeric_limits<CAmount>::max());
+    fSkippedBetter = false;
+    fValidated = false;
+}
 
+void CBlockAssembler::Unsubscribe()
+{
+    if (!fSubscribed)
+        return;
+    connAdded.disconnect();
+    connRemoved.disconnect();
+    connUpdated.disconnect();
+    fSubscribed = false;
+    Invalidate();
+}
+
+void CBlockAssembler::Update(const CBlockIndex* pindexPrev, int64_t nTime)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    if (!fSubscribed) {
+        connAdded = mempool.NotifyEntryAdded.connect(boost::bind(&CBlockAssembler::TransactionAdded, this, _1));
+        connRemoved = mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockAssembler::TransactionRemoved, this, _1));
+        connUpdated = mempool.NotifyEntryUpdated.connect(boost::bind(&CBlockAssembler::TransactionUpdated, this, _1));
+        fSubscribed = true;
+        fNeedRebuild = true;
+    }
+
+    nLockTimeCutoff = nTime;
+    if (fNeedRebuild || hashPrevBlock != pindexPrev->GetBlockHash() || nHeight != pindexPrev->nHeight + 1 ||
+        (fSkippedBetter && GetTime() - nLastRebuild >= BLOCK_TEMPLATE_REBUILD_INTERVAL))
     {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        pblock->nTime = GetAdjustedTime();
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
-        {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, pblock->nTime))
-                continue;
+        int64_t nStart = GetTimeMicros();
+        Reset();
+        hashPrevBlock = pindexPrev->GetBlockHash();
+        nHeight = pindexPrev->nHeight + 1;
+        nLastRebuild = GetTime();
+
+        // Transactions selected by coin age priority go first, the rest of
+        // the block is filled by ancestor package fee rate.
+        AddPriorityTxs();
+        AddPackageTxs();
+        LogPrint("bench", "    - Rebuild block template: %.2fms (%u txs)\n", 0.001 * (GetTimeMicros() - nStart), nBlockTx);
+        return;
+    }
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
+    if (vPendingAdds.empty())
+        return;
 
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
+    std::vector<CTxMemPool::txiter> vNew;
+    vNew.reserve(vPendingAdds.size());
+    BOOST_FOREACH(const uint256& hash, vPendingAdds) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it != mempool.mapTx.end())
+            vNew.push_back(it);
+    }
+    vPendingAdds.clear();
 
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
+    uint64_t nBlockTxBefore = nBlockTx;
+    if (AddNewTxs(vNew))
+        fSkippedBetter = true;
+    if (nBlockTx != nBlockTxBefore)
+        fValidated = false;
+}
 
-                int nConf = nHeight - coins->nHeight;
+void CBlockAssembler::TransactionAdded(const uint256& hash)
+{
+    if (fNeedRebuild)
+        return;
+    if (vPendingAdds.size() >= MAX_BLOCK_TEMPLATE_PENDING) {
+        // Nobody has asked for a template in a while; start over instead.
+        Invalidate();
+        return;
+    }
+    vPendingAdds.push_back(hash);
+}
 
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
+void CBlockAssembler::TransactionRemoved(const uint256& hash)
+{
+    // Once a rebuild is pending inBlock may hold iterators to entries that
+    // have already been erased, so it must not be searched.
+    if (fNeedRebuild)
+        return;
+    CTxMemPool::txiter it = mempool.mapTx.find(hash);
+    if (it != mempool.mapTx.end() && inBlock.count(it))
+        Invalidate();
+}
 
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
+void CBlockAssembler::TransactionUpdated(const uint256& hash)
+{
+    // A changed fee delta re-scores the whole package; simply start over.
+    Invalidate();
+}
 
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+void CBlockAssembler::AddToBlock(CTxMemPool::txiter iter)
+{
+    pblock->vtx.push_back(iter->GetTx());
+    pblocktemplate->vTxFees.push_back(iter->GetFee());
+    pblocktemplate->vTxSigOps.push_back(iter->GetSigOpCount());
+    nBlockSize += iter->GetTxSize();
+    ++nBlockTx;
+    nBlockSigOps += iter->GetSigOpCount();
+    nFees += iter->GetFee();
+    inBlock.insert(iter);
+
+    if (fPrintPriority)
+    {
+        double dPriority = iter->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+        LogPrintf("priority %.1f fee %s txid %s\n",
+                  dPriority,
+                  CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(),
+                  iter->GetTx().GetHash().ToString());
+    }
+}
 
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
+bool CBlockAssembler::TestForBlock(CTxMemPool::txiter iter) const
+{
+    if (nBlockSize + iter->GetTxSize() >= nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + iter->GetSigOpCount() >= MAX_BLOCK_SIGOPS)
+        return false;
+    return IsFinalTx(iter->GetTx(), nHeight, nLockTimeCutoff);
+}
 
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
+bool CBlockAssembler::TestPackage(uint64_t packageSize, unsigned int packageSigOps) const
+{
+    if (nBlockSize + packageSize >= nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + packageSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+    return true;
+}
+
+bool CBlockAssembler::TestPackageFinality(const CTxMemPool::setEntries& package) const
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, package) {
+        if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
+            return false;
+    }
+    return true;
+}
+
+bool CBlockAssembler::IsStillDependent(CTxMemPool::txiter iter) const
+{
+    BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
+    {
+        if (!inBlock.count(parent))
+            return true;
+    }
+    return false;
+}
+
+bool CBlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, const CTxMemPool::setEntries &failedTx) const
+{
+    assert(it != mempool.mapTx.end());
+    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
+}
+
+void CBlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
+                                             indexed_modified_transaction_set &mapModifiedTx) const
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
+            if (inBlock.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                modEntry.nSigOpsWithAncestors -= it->GetSigOpCount();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
             }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
         }
+    }
+}
+
+void CBlockAssembler::AddPriorityTxs()
+{
+    if (nBlockPrioritySize == 0)
+        return;
+
+    // This vector will be sorted into a priority queue:
+    vector<TxCoinAgePriority> vecPriority;
+    TxCoinAgePriorityCompare pricomparer;
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
+    {
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    while (!vecPriority.empty())
+    {
+        // Take highest priority transaction off the priority queue:
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        double dPriority = vecPriority.front().first;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        vecPriority.pop_back();
+
+        // Everything left pays for its space by fee rate instead
+        if (!AllowFree(dPriority))
+            break;
+
+        // Wait until all of its in-mempool parents are in the block
+        if (IsStillDependent(iter)) {
+            waitPriMap.insert(std::make_pair(iter, dPriority));
+            continue;
+        }
 
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        if (!TestForBlock(iter))
+            continue;
 
-        while (!vecPriority.empty())
+        AddToBlock(iter);
+        if (nBlockSize >= nBlockPrioritySize)
+            break;
+
+        // Children of this transaction may now be ready
+        BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
         {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+            waitPriIter wpiter = waitPriMap.find(child);
+            if (wpiter != waitPriMap.end()) {
+                vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                waitPriMap.erase(wpiter);
+            }
+        }
+    }
+}
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+void CBlockAssembler::AddPackageTxs()
+{
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
+    // Keep track of entries that failed inclusion, to avoid duplicate work
+    CTxMemPool::setEntries failedTx;
+
+    // Start by adding all descendants of previously added txs to mapModifiedTx
+    // and modifying them for their already included ancestors
+    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+    CTxMemPool::txiter iter;
+    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
+                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
+            ++mi;
+            continue;
+        }
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                    CompareTxMemPoolEntryByAncestorFee()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                // Switch which transaction (package) to consider
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                // Increment mi for the next loop iteration.
+                ++mi;
+            }
+        }
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+            packageSigOps = modit->nSigOpsWithAncestors;
+        }
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+        // Skip free transactions if we're past the minimum block size; since
+        // we walk in fee rate order, everything after this pays less.
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize)
+            return;
 
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        if (!TestPackage(packageSize, packageSigOps)) {
+            if (fUsingModified) {
+                // Since we always look at the best entry in mapModifiedTx,
+                // we must erase failed entries so that we can consider the
+                // next best entry on the next loop iteration
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
             }
+            continue;
+        }
 
-            if (!view.HaveInputs(tx))
-                continue;
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
 
-            CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+        // Drop the ancestors that are already in the block
+        for (CTxMemPool::setEntries::iterator ait = ancestors.begin(); ait != ancestors.end(); ) {
+            if (inBlock.count(*ait))
+                ancestors.erase(ait++);
+            else
+                ++ait;
+        }
+        ancestors.insert(iter);
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+        if (!TestPackageFinality(ancestors)) {
+            if (fUsingModified) {
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
+            }
+            continue;
+        }
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
+        // Package can be added. Sort the entries in a valid order.
+        vector<CTxMemPool::txiter> sortedEntries(ancestors.begin(), ancestors.end());
+        std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
 
-            UpdateCoins(tx, state, view, nHeight);
+        for (size_t i = 0; i < sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+            // Erase from the modified set, if present
+            mapModifiedTx.erase(sortedEntries[i]);
+        }
+        feeRateWorst = std::min(feeRateWorst, CFeeRate(packageFees, packageSize));
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(ancestors, mapModifiedTx);
+    }
+}
 
-            if (fPrintPriority)
-            {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
+bool CBlockAssembler::AddNewTxs(const std::vector<CTxMemPool::txiter>& vNew)
+{
+    bool fSkipped = false;
+    BOOST_FOREACH(CTxMemPool::txiter iter, vNew)
+    {
+        // Already pulled in as the ancestor of an earlier arrival
+        if (inBlock.count(iter))
+            continue;
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        // Only the part of the package that is not in the block yet counts
+        for (CTxMemPool::setEntries::iterator ait = ancestors.begin(); ait != ancestors.end(); ) {
+            if (inBlock.count(*ait))
+                ancestors.erase(ait++);
+            else
+                ++ait;
+        }
+        ancestors.insert(iter);
+
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        unsigned int packageSigOps = 0;
+        BOOST_FOREACH(CTxMemPool::txiter it, ancestors) {
+            packageSize += it->GetTxSize();
+            packageFees += it->GetModifiedFee();
+            packageSigOps += it->GetSigOpCount();
+        }
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize)
+            continue;
+
+        CFeeRate packageFeeRate(packageFees, packageSize);
+        if (!TestPackage(packageSize, packageSigOps)) {
+            // A rebuild only helps if this would displace something in the block
+            if (packageFeeRate > feeRateWorst)
+                fSkipped = true;
+            continue;
         }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+        if (!TestPackageFinality(ancestors))
+            continue;
+
+        vector<CTxMemPool::txiter> sortedEntries(ancestors.begin(), ancestors.end());
+        std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+        for (size_t i = 0; i < sortedEntries.size(); ++i)
+            AddToBlock(sortedEntries[i]);
+        feeRateWorst = std::min(feeRateWorst, packageFeeRate);
+    }
+    return fSkipped;
+}
+
+namespace {
+
+/** The template CreateNewBlock starts from; guarded by mempool.cs */
+CBlockAssembler blockAssembler;
+
+} // anon namespace
+
+void StopBlockAssembler()
+{
+    // Taking mempool.cs waits for a notification that is being delivered.
+    LOCK(mempool.cs);
+    blockAssembler.Unsubscribe();
+}
+
+void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
+{
+    pblock->nTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
+
+    // Updating time can change work required on testnet:
+    if (consensusParams.fPowAllowMinDifficultyBlocks)
+        pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, consensusParams);
+}
+
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    const CChainParams& chainparams = Params();
+    // Create new block
+    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if(!pblocktemplate.get())
+        return NULL;
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Create coinbase tx
+    CMutableTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+
+    {
+        LOCK2(cs_main, mempool.cs);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        const int nHeight = pindexPrev->nHeight + 1;
+
+        // Start from the persistent template, which only needs the mempool
+        // changes since the last call applied to it.
+        blockAssembler.Update(pindexPrev, GetAdjustedTime());
+        *pblocktemplate = blockAssembler.GetTemplate();
+        CAmount nFees = blockAssembler.GetFees();
+
+        // -regtest only: allow overriding block.nVersion with
+        // -blockversion=N to test forking scenarios
+        if (Params().MineBlocksOnDemand())
+            pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+        nLastBlockTx = blockAssembler.GetBlockTx();
+        nLastBlockSize = blockAssembler.GetBlockSize();
+        LogPrintf("CreateNewBlock(): total size %u\n", nLastBlockSize);
 
         // Compute final coinbase transaction.
         txNew.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
@@ -335,9 +612,16 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         pblock->nNonce         = 0;
         pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
-        CValidationState state;
-        if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
-            throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
+        // Only the coinbase and header differ between calls that share a
+        // selection, so the transactions need validating once per selection.
+        if (!blockAssembler.IsValidated()) {
+            CValidationState state;
+            if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
+                blockAssembler.Invalidate();
+                throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
+            }
+            blockAssembler.SetValidated();
+        }
     }
 
     return pblocktemplate.release();
@@ -601,10 +885,34 @@ void static GenericMiner(CWallet *pwallet)
         arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
         LogPrintf("TestcoinMiner target hash: %s\n", hashTarget.GetHex());
         uint256 hash;
+        // The first 64 header bytes are fixed for this template, only the tail
+        // (nTime, nBits, nNonce) changes inside the loop.
+        const unsigned char* pheader = (const unsigned char*)BEGIN(pblock->nVersion);
+        const CSkeinHeaderMidstate midstate(pheader);
+        unsigned char tails[SKEIN_BATCH_SIZE * CSkeinHeaderMidstate::TAIL_SIZE];
+        unsigned char hashes[SKEIN_BATCH_SIZE * 32];
         while(true)
         {
-            hash = pblock->GetPoWHash();
-            if (UintToArith256(hash) <= hashTarget){
+            // Hash a batch of consecutive nonces across the SIMD lanes
+            for (unsigned int i = 0; i < SKEIN_BATCH_SIZE; i++) {
+                unsigned char* ptail = tails + i * CSkeinHeaderMidstate::TAIL_SIZE;
+                uint32_t nNonce = pblock->nNonce + i;
+                memcpy(ptail, pheader + CSkeinHeaderMidstate::PREFIX_SIZE, CSkeinHeaderMidstate::TAIL_SIZE - 4);
+                memcpy(ptail + CSkeinHeaderMidstate::TAIL_SIZE - 4, &nNonce, 4);
+            }
+            midstate.FinalizeBatch(hashes, tails, SKEIN_BATCH_SIZE);
+
+            bool fFound = false;
+            for (unsigned int i = 0; i < SKEIN_BATCH_SIZE; i++) {
+                memcpy(hash.begin(), hashes + i * 32, 32);
+                if (UintToArith256(hash) <= hashTarget) {
+                    pblock->nNonce += i;
+                    fFound = true;
+                    break;
+                }
+            }
+            if (fFound) {
+                assert(hash == pblock->GetPoWHash());
                 SetThreadPriority(THREAD_PRIORITY_NORMAL);
                 LogPrintf("TestcoinMiner:\n");
                 LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex(), hashTarget.GetHex());
@@ -617,7 +925,7 @@ void static GenericMiner(CWallet *pwallet)
                 
                 break;
             }
-            ++pblock->nNonce;
+            pblock->nNonce += SKEIN_BATCH_SIZE;
 
             // Check for stop or if block needs to be rebuilt
             boost::this_thread::interruption_point();
@@ -7,9 +7,14 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "txmempool.h"
 
 #include <stdint.h>
 
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/signals2/connection.hpp>
+
 class CBlockIndex;
 class CReserveKey;
 class CScript;
@@ -23,6 +28,161 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOps;
 };
 
+/** A mempool entry whose ancestor statistics have been adjusted for the
+ *  ancestors that are already in the block being assembled. */
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpsWithAncestors = entry->GetSigOpCountWithAncestors();
+    }
+
+    // Accessors used by CompareTxMemPoolEntryByAncestorFee
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+    const CTransaction& GetTx() const { return iter->GetTx(); }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpsWithAncestors;
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CTxMemPool::CompareIteratorByHash
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareTxMemPoolEntryByAncestorFee
+        >
+    >
+> indexed_modified_transaction_set;
+
+/**
+ * Keeps a block template on top of the current tip up to date with the
+ * mempool. A full build walks the whole mempool; after that, transactions
+ * that enter the mempool are appended with their ancestor packages as long as
+ * they fit, so polling for a template does not rescan the pool. The template
+ * is rebuilt from scratch when the tip changes, when one of its transactions
+ * leaves the mempool or is reprioritised, and at most every
+ * BLOCK_TEMPLATE_REBUILD_INTERVAL seconds when a package paying a higher
+ * fee rate than the worst one in the template had to be skipped for lack of
+ * space.
+ *
+ * All state is guarded by mempool.cs: the mempool notifications arrive with
+ * it held, and Update() requires both cs_main and mempool.cs.
+ */
+class CBlockAssembler
+{
+private:
+    CBlockTemplate blocktemplate;
+    CBlockTemplate* pblocktemplate;
+    CBlock* pblock;
+
+    // Configuration parameters for the block size
+    unsigned int nBlockMaxSize, nBlockMinSize, nBlockPrioritySize;
+
+    // Information on the current status of the block
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    CTxMemPool::setEntries inBlock;
+
+    // Chain context for the block
+    uint256 hashPrevBlock;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    bool fPrintPriority;
+
+    // Incremental update state
+    bool fSubscribed;
+    boost::signals2::connection connAdded, connRemoved, connUpdated;
+    bool fNeedRebuild;
+    //! Lowest fee rate of the packages selected by fee rate
+    CFeeRate feeRateWorst;
+    //! A package paying more than feeRateWorst did not fit
+    bool fSkippedBetter;
+    bool fValidated;
+    int64_t nLastRebuild;
+    std::vector<uint256> vPendingAdds;
+
+public:
+    CBlockAssembler() :
+        pblocktemplate(&blocktemplate), pblock(&blocktemplate.block),
+        nBlockMaxSize(0), nBlockMinSize(0), nBlockPrioritySize(0),
+        nBlockSize(0), nBlockTx(0), nBlockSigOps(0), nFees(0),
+        nHeight(0), nLockTimeCutoff(0), fPrintPriority(false),
+        fSubscribed(false), fNeedRebuild(true), feeRateWorst(0), fSkippedBetter(false), fValidated(false), nLastRebuild(0)
+    {
+        // The first Update() subscribes to the mempool and does a full build;
+        // arguments are not parsed yet when this is constructed.
+    }
+    ~CBlockAssembler() { Unsubscribe(); }
+
+    /** Bring the template up to date with pindexPrev and the mempool */
+    void Update(const CBlockIndex* pindexPrev, int64_t nTime);
+
+    const CBlockTemplate& GetTemplate() const { return blocktemplate; }
+    uint64_t GetBlockSize() const { return nBlockSize; }
+    uint64_t GetBlockTx() const { return nBlockTx; }
+    CAmount GetFees() const { return nFees; }
+    /** Whether the current selection already passed TestBlockValidity */
+    bool IsValidated() const { return fValidated; }
+    void SetValidated() { fValidated = true; }
+    /** Force a full build on the next Update() */
+    void Invalidate() { fNeedRebuild = true; vPendingAdds.clear(); }
+    /** Stop listening to the mempool; the next Update() subscribes again.
+     *  Requires mempool.cs unless no notification can be under way. */
+    void Unsubscribe();
+
+    // Mempool notifications
+    void TransactionAdded(const uint256& hash);
+    void TransactionRemoved(const uint256& hash);
+    void TransactionUpdated(const uint256& hash);
+
+private:
+    /** Drop the current selection, leaving only the dummy coinbase */
+    void Reset();
+    /** Add transactions by coin age priority, up to nBlockPrioritySize */
+    void AddPriorityTxs();
+    /** Add transactions by ancestor package fee rate */
+    void AddPackageTxs();
+    /** Add the packages of newly arrived transactions that still fit.
+     *  Returns whether a package paying more than feeRateWorst had to be skipped. */
+    bool AddNewTxs(const std::vector<CTxMemPool::txiter>& vNew);
+
+    void AddToBlock(CTxMemPool::txiter iter);
+    /** Test if a single transaction would fit in the block */
+    bool TestForBlock(CTxMemPool::txiter iter) const;
+    /** Test if a package of the given size and sigops would fit in the block */
+    bool TestPackage(uint64_t packageSize, unsigned int packageSigOps) const;
+    /** Test if all transactions of a package are final */
+    bool TestPackageFinality(const CTxMemPool::setEntries& package) const;
+    /** Whether a transaction still has in-mempool parents outside the block */
+    bool IsStillDependent(CTxMemPool::txiter iter) const;
+    /** Whether a mapTx entry has already been handled or has been re-scored */
+    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, const CTxMemPool::setEntries &failedTx) const;
+    /** Re-score the in-mempool descendants of transactions just added to the block */
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx) const;
+};
+
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads);
 /** Generate a new block, without valid proof-of-work */
@@ -31,5 +191,7 @@ CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
+/** Disconnect the template kept by CreateNewBlock from the mempool, before shutdown */
+void StopBlockAssembler();
 
 #endif // BITCOIN_MINER_H
@@ -8,15 +8,189 @@
 
 #include "ecwrapper.h"
 
+#include <secp256k1.h>
+
+namespace
+{
+/* Global secp256k1_context_t object used for verification. */
+secp256k1_context_t* secp256k1_context_verify = NULL;
+}
+
+/** This function is taken from the libsecp256k1 distribution and implements
+ *  DER parsing for ECDSA signatures, while supporting an arbitrary subset of
+ *  format violations.
+ *
+ *  Supported violations include negative integers, excessive padding, garbage
+ *  at the end, and overly long length descriptors. This is safe to use in
+ *  Bitcoin because since the activation of BIP66, signatures are verified to be
+ *  strict DER before being passed to this module, and we know it supports all
+ *  violations present in the blockchain before that point.
+ *
+ *  On success the 32-byte big-endian R and S values are written to r and s.
+ *  Returns 0 if the encoding could not be parsed, -1 if R or S does not fit in
+ *  32 bytes (such a signature can never be valid), and 1 otherwise.
+ */
+static int ecdsa_signature_parse_der_lax(unsigned char* r, unsigned char* s, const unsigned char* input, size_t inputlen)
+{
+    size_t rpos, rlen, spos, slen;
+    size_t pos = 0;
+    size_t lenbyte;
+
+    memset(r, 0, 32);
+    memset(s, 0, 32);
+
+    /* Sequence tag byte */
+    if (pos == inputlen || input[pos] != 0x30) {
+        return 0;
+    }
+    pos++;
+
+    /* Sequence length bytes */
+    if (pos == inputlen) {
+        return 0;
+    }
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (pos + lenbyte > inputlen) {
+            return 0;
+        }
+        pos += lenbyte;
+    }
+
+    /* Integer tag byte for R */
+    if (pos == inputlen || input[pos] != 0x02) {
+        return 0;
+    }
+    pos++;
+
+    /* Integer length for R */
+    if (pos == inputlen) {
+        return 0;
+    }
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (pos + lenbyte > inputlen) {
+            return 0;
+        }
+        while (lenbyte > 0 && input[pos] == 0) {
+            pos++;
+            lenbyte--;
+        }
+        if (lenbyte >= sizeof(size_t)) {
+            return 0;
+        }
+        rlen = 0;
+        while (lenbyte > 0) {
+            rlen = (rlen << 8) + input[pos];
+            pos++;
+            lenbyte--;
+        }
+    } else {
+        rlen = lenbyte;
+    }
+    if (rlen > inputlen - pos) {
+        return 0;
+    }
+    rpos = pos;
+    pos += rlen;
+
+    /* Integer tag byte for S */
+    if (pos == inputlen || input[pos] != 0x02) {
+        return 0;
+    }
+    pos++;
+
+    /* Integer length for S */
+    if (pos == inputlen) {
+        return 0;
+    }
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (pos + lenbyte > inputlen) {
+            return 0;
+        }
+        while (lenbyte > 0 && input[pos] == 0) {
+            pos++;
+            lenbyte--;
+        }
+        if (lenbyte >= sizeof(size_t)) {
+            return 0;
+        }
+        slen = 0;
+        while (lenbyte > 0) {
+            slen = (slen << 8) + input[pos];
+            pos++;
+            lenbyte--;
+        }
+    } else {
+        slen = lenbyte;
+    }
+    if (slen > inputlen - pos) {
+        return 0;
+    }
+    spos = pos;
+    pos += slen;
+
+    /* Ignore leading zeroes in R */
+    while (rlen > 0 && input[rpos] == 0) {
+        rlen--;
+        rpos++;
+    }
+    /* Copy R value */
+    if (rlen > 32) {
+        return -1;
+    }
+    memcpy(r + 32 - rlen, input + rpos, rlen);
+
+    /* Ignore leading zeroes in S */
+    while (slen > 0 && input[spos] == 0) {
+        slen--;
+        spos++;
+    }
+    /* Copy S value */
+    if (slen > 32) {
+        return -1;
+    }
+    memcpy(s + 32 - slen, input + spos, slen);
+
+    return 1;
+}
+
+/** Append a 32-byte big-endian value as a minimal DER integer. */
+static void ecdsa_der_push_integer(std::vector<unsigned char>& out, const unsigned char* val)
+{
+    size_t skip = 0;
+    while (skip < 31 && val[skip] == 0)
+        skip++;
+    bool fPad = (val[skip] & 0x80) != 0;
+    out.push_back(0x02);
+    out.push_back(32 - skip + fPad);
+    if (fPad)
+        out.push_back(0x00);
+    out.insert(out.end(), val + skip, val + 32);
+}
+
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(begin(), size()))
+    if (vchSig.empty())
         return false;
-    if (!key.Verify(hash, vchSig))
+    unsigned char r[32], s[32];
+    if (ecdsa_signature_parse_der_lax(r, s, &vchSig[0], vchSig.size()) != 1)
         return false;
-    return true;
+    // libsecp256k1 only accepts strict DER, so hand it a canonical encoding
+    // of the values the lax parser recovered.
+    std::vector<unsigned char> vchDER;
+    vchDER.reserve(72);
+    vchDER.push_back(0x30);
+    vchDER.push_back(0x00);
+    ecdsa_der_push_integer(vchDER, r);
+    ecdsa_der_push_integer(vchDER, s);
+    vchDER[1] = vchDER.size() - 2;
+    return secp256k1_ecdsa_verify(secp256k1_context_verify, hash.begin(), &vchDER[0], vchDER.size(), begin(), size()) == 1;
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
@@ -95,3 +269,25 @@ bool CExtPubKey::Derive(CExtPubKey &out, unsigned int nChild) const {
     out.nChild = nChild;
     return pubkey.Derive(out.pubkey, out.chaincode, nChild, chaincode);
 }
+
+/* static */ int ECCVerifyHandle::refcount = 0;
+
+ECCVerifyHandle::ECCVerifyHandle()
+{
+    if (refcount == 0) {
+        assert(secp256k1_context_verify == NULL);
+        secp256k1_context_verify = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY);
+        assert(secp256k1_context_verify != NULL);
+    }
+    refcount++;
+}
+
+ECCVerifyHandle::~ECCVerifyHandle()
+{
+    refcount--;
+    if (refcount == 0) {
+        assert(secp256k1_context_verify != NULL);
+        secp256k1_context_destroy(secp256k1_context_verify);
+        secp256k1_context_verify = NULL;
+    }
+}
@@ -169,6 +169,12 @@ Value getrawmempool(const Array& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees (see prioritisetransaction) of in-mempool descendants (including this one), in satoshis\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees (see prioritisetransaction) of in-mempool ancestors (including this one), in satoshis\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -189,10 +195,9 @@ Value getrawmempool(const Array& params, bool fHelp)
     {
         LOCK(mempool.cs);
         Object o;
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
         {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+            const uint256& hash = e.GetTx().GetHash();
             Object info;
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -200,6 +205,12 @@ Value getrawmempool(const Array& params, bool fHelp)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
@@ -409,33 +420,34 @@ Value gettxout(const Array& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return Value::null;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out))
             return Value::null;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return Value::null;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return Value::null;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", pindex->nHeight - (int)coin.nHeight + 1));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     Object o;
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("version", coin.nVersion));
+    ret.push_back(Pair("coinbase", coin.fCoinBase));
 
     return ret;
 }
@@ -626,6 +638,9 @@ Value getmempoolinfo(const Array& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -635,6 +650,94 @@ Value getmempoolinfo(const Array& params, bool fHelp)
     Object ret;
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+
+    return ret;
+}
+
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the signature cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx             (numeric) Number of cached signatures\n"
+            "  \"capacity\": xxxxx            (numeric) Maximum number of cached signatures\n"
+            "  \"bytes\": xxxxx               (numeric) Memory allocated for the cache\n"
+            "  \"hits\": xxxxx                (numeric) Lookups that found the signature in the cache\n"
+            "  \"misses\": xxxxx              (numeric) Lookups that did not\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    CSignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    Object ret;
+    ret.push_back(Pair("entries", (int64_t)stats.nEntries));
+    ret.push_back(Pair("capacity", (int64_t)stats.nCapacity));
+    ret.push_back(Pair("bytes", (int64_t)stats.nBytes));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (int64_t)stats.nMisses));
+
+    return ret;
+}
+
+Value getcoincacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcoincacheinfo\n"
+            "\nReturns details on the in-memory cache of the unspent transaction output set.\n"
+            "Note this call may take some time with a large cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx             (numeric) Number of cached transaction outputs\n"
+            "  \"bytes\": xxxxx               (numeric) Memory used by the cache\n"
+            "  \"limit\": xxxxx               (numeric) Memory the cache may use before it is trimmed or written\n"
+            "  \"dirty_entries\": xxxxx       (numeric) Number of entries not yet written to disk\n"
+            "  \"dirty_bytes\": xxxxx         (numeric) Memory used by the outputs of those entries\n"
+            "  \"hits\": xxxxx                (numeric) Lookups answered from the cache\n"
+            "  \"misses\": xxxxx              (numeric) Lookups that had to go to disk\n"
+            "  \"hitrate\": x.xxx             (numeric) Fraction of lookups answered from the cache\n"
+            "  \"evicted\": xxxxx             (numeric) Clean entries evicted to make room\n"
+            "  \"writes\": xxxxx              (numeric) Number of times the cache was written to disk\n"
+            "  \"last_write_time\": xxxxx     (numeric) Time of the last write in seconds since epoch (Jan 1 1970 GMT)\n"
+            "  \"last_write_ms\": x.xxx       (numeric) Duration of the last write in milliseconds\n"
+            "  \"total_write_ms\": x.xxx      (numeric) Duration of all writes together in milliseconds\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcoincacheinfo", "")
+            + HelpExampleRpc("getcoincacheinfo", "")
+        );
+
+    LOCK(cs_main);
+
+    CCoinsCacheStats stats;
+    pcoinsTip->GetCacheStats(stats);
+    uint64_t nLookups = stats.nHits + stats.nMisses;
+
+    Object ret;
+    ret.push_back(Pair("entries", (int64_t)stats.nEntries));
+    ret.push_back(Pair("bytes", (int64_t)stats.nUsage));
+    ret.push_back(Pair("limit", (int64_t)nCoinCacheUsage));
+    ret.push_back(Pair("dirty_entries", (int64_t)stats.nDirtyEntries));
+    ret.push_back(Pair("dirty_bytes", (int64_t)stats.nDirtyUsage));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (int64_t)stats.nMisses));
+    ret.push_back(Pair("hitrate", nLookups ? (double)stats.nHits / nLookups : 0.0));
+    ret.push_back(Pair("evicted", (int64_t)stats.nEvicted));
+    ret.push_back(Pair("writes", (int64_t)coinsWriteStats.nWrites));
+    ret.push_back(Pair("last_write_time", coinsWriteStats.nLastWriteTime));
+    ret.push_back(Pair("last_write_ms", coinsWriteStats.nLastWriteMicros * 0.001));
+    ret.push_back(Pair("total_write_ms", coinsWriteStats.nTotalWriteMicros * 0.001));
 
     return ret;
 }
@@ -317,6 +317,139 @@ static Value BIP22ValidationResult(const CValidationState& state)
     return "valid?";
 }
 
+namespace {
+
+/**
+ * The template getblocktemplate last built, and its rendered result. Pool
+ * servers poll getblocktemplate from many workers, and as long as the tip
+ * and the mempool have not changed those polls are served from here without
+ * holding cs_main for a new block or re-encoding the transactions. The
+ * result does not depend on the capabilities a client requests.
+ * Tip changes are seen through hashBestChain, which UpdateTip() publishes
+ * under csBestBlock right before waking up longpolls.
+ */
+struct CBlockTemplateCache
+{
+    CBlockTemplate* pblocktemplate;
+    CBlockIndex* pindexPrev;
+    unsigned int nTransactionsUpdated;
+    int64_t nStart;
+    Object result;
+    bool fRendered;
+
+    CBlockTemplateCache() : pblocktemplate(NULL), pindexPrev(NULL), nTransactionsUpdated(0), nStart(0), fRendered(false) {}
+
+    /** Whether a request on top of hashTip may be answered from the cache */
+    bool IsFresh(const uint256& hashTip) const
+    {
+        if (!fRendered || pindexPrev == NULL || pindexPrev->GetBlockHash() != hashTip)
+            return false;
+        return mempool.GetTransactionsUpdated() == nTransactionsUpdated || GetTime() - nStart <= 5;
+    }
+
+    /** The cached result with the time (and on testnet the difficulty) brought up to date */
+    Object GetResult() const
+    {
+        CBlockHeader header = pblocktemplate->block.GetBlockHeader();
+        UpdateTime(&header, Params().GetConsensus(), pindexPrev);
+
+        Object ret = result;
+        BOOST_FOREACH(Pair& pair, ret)
+        {
+            if (pair.name_ == "curtime")
+                pair.value_ = header.GetBlockTime();
+            else if (pair.name_ == "bits")
+                pair.value_ = strprintf("%08x", header.nBits);
+            else if (pair.name_ == "target")
+                pair.value_ = arith_uint256().SetCompact(header.nBits).GetHex();
+        }
+        return ret;
+    }
+};
+
+} // anon namespace
+
+static CCriticalSection cs_blocktemplate;
+static CBlockTemplateCache blocktemplatecache;
+
+static uint256 GetBestChainHash()
+{
+    boost::unique_lock<boost::mutex> lock(csBestBlock);
+    return hashBestChain;
+}
+
+static Object BlockTemplateToJSON(const CBlockTemplate& blocktemplate, const CBlockIndex* pindexPrev, unsigned int nTransactionsUpdated)
+{
+    const CBlock* pblock = &blocktemplate.block; // pointer for convenience
+
+    static const Array aCaps = boost::assign::list_of("proposal");
+
+    Array transactions;
+    map<uint256, int64_t> setTxIndex;
+    int i = 0;
+    BOOST_FOREACH (const CTransaction& tx, pblock->vtx)
+    {
+        uint256 txHash = tx.GetHash();
+        setTxIndex[txHash] = i++;
+
+        if (tx.IsCoinBase())
+            continue;
+
+        Object entry;
+
+        entry.push_back(Pair("data", EncodeHexTx(tx)));
+
+        entry.push_back(Pair("hash", txHash.GetHex()));
+
+        Array deps;
+        BOOST_FOREACH (const CTxIn &in, tx.vin)
+        {
+            if (setTxIndex.count(in.prevout.hash))
+                deps.push_back(setTxIndex[in.prevout.hash]);
+        }
+        entry.push_back(Pair("depends", deps));
+
+        int index_in_template = i - 1;
+        entry.push_back(Pair("fee", blocktemplate.vTxFees[index_in_template]));
+        entry.push_back(Pair("sigops", blocktemplate.vTxSigOps[index_in_template]));
+
+        transactions.push_back(entry);
+    }
+
+    Object aux;
+    aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
+
+    arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
+
+    static Array aMutable;
+    if (aMutable.empty())
+    {
+        aMutable.push_back("time");
+        aMutable.push_back("transactions");
+        aMutable.push_back("prevblock");
+    }
+
+    Object result;
+    result.push_back(Pair("capabilities", aCaps));
+    result.push_back(Pair("version", pblock->nVersion));
+    result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
+    result.push_back(Pair("transactions", transactions));
+    result.push_back(Pair("coinbaseaux", aux));
+    result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
+    result.push_back(Pair("longpollid", pindexPrev->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdated)));
+    result.push_back(Pair("target", hashTarget.GetHex()));
+    result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
+    result.push_back(Pair("mutable", aMutable));
+    result.push_back(Pair("noncerange", "00000000ffffffff"));
+    result.push_back(Pair("sigoplimit", (int64_t)MAX_BLOCK_SIGOPS));
+    result.push_back(Pair("sizelimit", (int64_t)MAX_BLOCK_SIZE));
+    result.push_back(Pair("curtime", pblock->GetBlockTime()));
+    result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
+    result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+
+    return result;
+}
+
 Value getblocktemplate(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -379,8 +512,6 @@ Value getblocktemplate(const Array& params, bool fHelp)
             + HelpExampleRpc("getblocktemplate", "")
          );
 
-    LOCK(cs_main);
-
     std::string strMode = "template";
     Value lpval = Value::null;
     if (params.size() > 0)
@@ -407,6 +538,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
             if (!DecodeHexBlk(block, dataval.get_str()))
                 throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Block decode failed");
 
+            LOCK(cs_main);
             uint256 hash = block.GetHash();
             BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end()) {
@@ -434,11 +566,6 @@ Value getblocktemplate(const Array& params, bool fHelp)
     if (vNodes.empty())
         throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Bitcoin is not connected!");
 
-    if (IsInitialBlockDownload())
-        throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Bitcoin is downloading blocks...");
-
-    static unsigned int nTransactionsUpdatedLast;
-
     if (lpval.type() != null_type)
     {
         // Wait to respond until either the best block changes, OR a minute has passed and there are more transactions
@@ -457,17 +584,17 @@ Value getblocktemplate(const Array& params, bool fHelp)
         else
         {
             // NOTE: Spec does not specify behaviour for non-string longpollid, but this makes testing easier
-            hashWatchedChain = chainActive.Tip()->GetBlockHash();
-            nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
+            hashWatchedChain = GetBestChainHash();
+            LOCK(cs_blocktemplate);
+            nTransactionsUpdatedLastLP = blocktemplatecache.nTransactionsUpdated;
         }
 
-        // Release the wallet and main lock while waiting
-        LEAVE_CRITICAL_SECTION(cs_main);
+        // The tip is watched through hashBestChain, so no locks are held while waiting
         {
             checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
 
             boost::unique_lock<boost::mutex> lock(csBestBlock);
-            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
+            while (hashBestChain == hashWatchedChain && IsRPCRunning())
             {
                 if (!cvBlockChange.timed_wait(lock, checktxtime))
                 {
@@ -478,114 +605,69 @@ Value getblocktemplate(const Array& params, bool fHelp)
                 }
             }
         }
-        ENTER_CRITICAL_SECTION(cs_main);
 
         if (!IsRPCRunning())
             throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
+    // Repeat requests are answered from the cache without taking cs_main. A
+    // template is only ever built out of initial block download, but until
+    // IsInitialBlockDownload() latched that, ask it below under cs_main.
+    {
+        uint256 hashTip;
+        bool fLatched;
+        {
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            hashTip = hashBestChain;
+            fLatched = fInitialDownloadLatched;
+        }
+        LOCK(cs_blocktemplate);
+        if (fLatched && blocktemplatecache.IsFresh(hashTip))
+            return blocktemplatecache.GetResult();
+    }
+
+    LOCK2(cs_main, cs_blocktemplate);
+
+    if (IsInitialBlockDownload())
+        throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Bitcoin is downloading blocks...");
+
     // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+    CBlockTemplateCache& cache = blocktemplatecache;
+    if (cache.pindexPrev != chainActive.Tip() ||
+        (mempool.GetTransactionsUpdated() != cache.nTransactionsUpdated && GetTime() - cache.nStart > 5))
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
+        cache.pindexPrev = NULL;
+        cache.fRendered = false;
 
         // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        cache.nTransactionsUpdated = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
+        cache.nStart = GetTime();
 
         // Create new block
-        if(pblocktemplate)
+        if(cache.pblocktemplate)
         {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
+            delete cache.pblocktemplate;
+            cache.pblocktemplate = NULL;
         }
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
+        cache.pblocktemplate = CreateNewBlock(scriptDummy);
+        if (!cache.pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
         // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
-
-    // Update nTime
-    UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
-    pblock->nNonce = 0;
-
-    static const Array aCaps = boost::assign::list_of("proposal");
-
-    Array transactions;
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    BOOST_FOREACH (CTransaction& tx, pblock->vtx)
-    {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
-
-        if (tx.IsCoinBase())
-            continue;
-
-        Object entry;
-
-        entry.push_back(Pair("data", EncodeHexTx(tx)));
-
-        entry.push_back(Pair("hash", txHash.GetHex()));
-
-        Array deps;
-        BOOST_FOREACH (const CTxIn &in, tx.vin)
-        {
-            if (setTxIndex.count(in.prevout.hash))
-                deps.push_back(setTxIndex[in.prevout.hash]);
-        }
-        entry.push_back(Pair("depends", deps));
-
-        int index_in_template = i - 1;
-        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
-        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
-
-        transactions.push_back(entry);
+        cache.pindexPrev = pindexPrevNew;
     }
 
-    Object aux;
-    aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
-
-    arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
-
-    static Array aMutable;
-    if (aMutable.empty())
+    if (!cache.fRendered)
     {
-        aMutable.push_back("time");
-        aMutable.push_back("transactions");
-        aMutable.push_back("prevblock");
+        cache.result = BlockTemplateToJSON(*cache.pblocktemplate, cache.pindexPrev, cache.nTransactionsUpdated);
+        cache.fRendered = true;
     }
 
-    Object result;
-    result.push_back(Pair("capabilities", aCaps));
-    result.push_back(Pair("version", pblock->nVersion));
-    result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
-    result.push_back(Pair("transactions", transactions));
-    result.push_back(Pair("coinbaseaux", aux));
-    result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
-    result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
-    result.push_back(Pair("target", hashTarget.GetHex()));
-    result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
-    result.push_back(Pair("mutable", aMutable));
-    result.push_back(Pair("noncerange", "00000000ffffffff"));
-    result.push_back(Pair("sigoplimit", (int64_t)MAX_BLOCK_SIGOPS));
-    result.push_back(Pair("sizelimit", (int64_t)MAX_BLOCK_SIZE));
-    result.push_back(Pair("curtime", pblock->GetBlockTime()));
-    result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
-    result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
-
-    return result;
+    return cache.GetResult();
 }
 
 class submitblock_StateCatcher : public CValidationInterface
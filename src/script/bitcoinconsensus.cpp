@@ -6,6 +6,7 @@
 #include "bitcoinconsensus.h"
 
 #include "primitives/transaction.h"
+#include "pubkey.h"
 #include "script/interpreter.h"
 #include "version.h"
 
@@ -53,6 +54,13 @@ private:
     size_t m_remaining;
 };
 
+struct ECCryptoClosure
+{
+    ECCVerifyHandle handle;
+};
+
+ECCryptoClosure instance_of_eccryptoclosure;
+
 inline int set_error(bitcoinconsensus_error* ret, bitcoinconsensus_error serror)
 {
     if (ret)
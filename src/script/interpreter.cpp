@@ -6,12 +6,14 @@
 #include "interpreter.h"
 
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "eccryptoverify.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 
 using namespace std;
@@ -936,6 +938,29 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
 
 namespace {
 
+/** Serialize scriptCode for a signature hash, skipping OP_CODESEPARATORs */
+template<typename S>
+void SerializeScriptCode(S &s, const CScript& scriptCode) {
+    CScript::const_iterator it = scriptCode.begin();
+    CScript::const_iterator itBegin = it;
+    opcodetype opcode;
+    unsigned int nCodeSeparators = 0;
+    while (scriptCode.GetOp(it, opcode)) {
+        if (opcode == OP_CODESEPARATOR)
+            nCodeSeparators++;
+    }
+    ::WriteCompactSize(s, scriptCode.size() - nCodeSeparators);
+    it = itBegin;
+    while (scriptCode.GetOp(it, opcode)) {
+        if (opcode == OP_CODESEPARATOR) {
+            s.write((char*)&itBegin[0], it-itBegin-1);
+            itBegin = it;
+        }
+    }
+    if (itBegin != scriptCode.end())
+        s.write((char*)&itBegin[0], it-itBegin);
+}
+
 /**
  * Wrapper that serializes like CTransaction, but with the modifications
  *  required for the signature hash done in-place
@@ -959,24 +984,7 @@ public:
     /** Serialize the passed scriptCode, skipping OP_CODESEPARATORs */
     template<typename S>
     void SerializeScriptCode(S &s, int nType, int nVersion) const {
-        CScript::const_iterator it = scriptCode.begin();
-        CScript::const_iterator itBegin = it;
-        opcodetype opcode;
-        unsigned int nCodeSeparators = 0;
-        while (scriptCode.GetOp(it, opcode)) {
-            if (opcode == OP_CODESEPARATOR)
-                nCodeSeparators++;
-        }
-        ::WriteCompactSize(s, scriptCode.size() - nCodeSeparators);
-        it = itBegin;
-        while (scriptCode.GetOp(it, opcode)) {
-            if (opcode == OP_CODESEPARATOR) {
-                s.write((char*)&itBegin[0], it-itBegin-1);
-                itBegin = it;
-            }
-        }
-        if (itBegin != scriptCode.end())
-            s.write((char*)&itBegin[0], it-itBegin);
+        ::SerializeScriptCode(s, scriptCode);
     }
 
     /** Serialize an input of txTo */
@@ -1031,9 +1039,71 @@ public:
     }
 };
 
+/** Stream that feeds everything written to it into a CSHA256. */
+class CSHA256Writer
+{
+private:
+    CSHA256& hasher;
+
+public:
+    CSHA256Writer(CSHA256& hasherIn) : hasher(hasherIn) {}
+
+    CSHA256Writer& write(const char* pch, size_t size)
+    {
+        hasher.Write((const unsigned char*)pch, size);
+        return *this;
+    }
+};
+
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    ::WriteCompactSize(ss, txTo.vin.size());
+    nInputsOffset = ss.size();
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        ss << txTo.vin[i].prevout << CScript() << txTo.vin[i].nSequence;
+    ss << txTo.vout << txTo.nLockTime;
+    vchBlanked.assign(ss.begin(), ss.end());
+
+    vMidstates.reserve(txTo.vin.size());
+    CSHA256 hasher;
+    hasher.Write(&vchBlanked[0], nInputsOffset);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+        vMidstates.push_back(hasher);
+        hasher.Write(&vchBlanked[nInputsOffset + i * BLANK_INPUT_SIZE], BLANK_INPUT_SIZE);
+    }
+}
+
+bool PrecomputedTransactionData::SignatureHash(uint256& hash, const CScript& scriptCode, unsigned int nIn, int nHashType) const
+{
+    // Exactly the hash types CTransactionSignatureSerializer serializes with
+    // all inputs and outputs.
+    if ((nHashType & SIGHASH_ANYONECANPAY) || (nHashType & 0x1f) == SIGHASH_SINGLE || (nHashType & 0x1f) == SIGHASH_NONE)
+        return false;
+    assert(nIn < vMidstates.size());
+
+    const unsigned char* pInput = &vchBlanked[nInputsOffset + nIn * BLANK_INPUT_SIZE];
+    const unsigned char* pNext = pInput + BLANK_INPUT_SIZE;
+    CSHA256 hasher = vMidstates[nIn];
+    hasher.Write(pInput, 36);
+    CSHA256Writer s(hasher);
+    SerializeScriptCode(s, scriptCode);
+    hasher.Write(pInput + 37, 4);
+    hasher.Write(pNext, &vchBlanked[0] + vchBlanked.size() - pNext);
+    unsigned char vchHashType[4];
+    WriteLE32(vchHashType, nHashType);
+    hasher.Write(vchHashType, 4);
+
+    unsigned char vchHash[CSHA256::OUTPUT_SIZE];
+    hasher.Finalize(vchHash);
+    CSHA256().Write(vchHash, sizeof(vchHash)).Finalize(hash.begin());
+    return true;
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* txdata)
 {
     static const uint256 one(uint256S("0000000000000000000000000000000000000000000000000000000000000001"));
     if (nIn >= txTo.vin.size()) {
@@ -1049,6 +1119,10 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         }
     }
 
+    uint256 hash;
+    if (txdata && txdata->SignatureHash(hash, scriptCode, nIn, nHashType))
+        return hash;
+
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
@@ -1076,7 +1150,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, txdata);
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
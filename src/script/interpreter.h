@@ -7,6 +7,7 @@
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
 #include "script_error.h"
+#include "crypto/sha256.h"
 #include "primitives/transaction.h"
 
 #include <vector>
@@ -78,7 +79,39 @@ enum
     SCRIPT_VERIFY_CLEANSTACK = (1U << 8),
 };
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * The parts of a transaction's signature hash that do not depend on the input
+ * being signed, for signature hash types that commit to all inputs and
+ * outputs (SIGHASH_ALL, by far the most common). Every input but the signed
+ * one is serialized with a blank script, so that serialization is the same
+ * for all of them: it is built once per transaction, along with the SHA256
+ * midstate in front of each input, and then shared by all signature checks
+ * of the transaction instead of re-serializing it for each one.
+ */
+class PrecomputedTransactionData
+{
+private:
+    //! The transaction serialized with all input scripts blanked
+    std::vector<unsigned char> vchBlanked;
+    //! Size of the serialized version and input count, where the inputs start
+    size_t nInputsOffset;
+    //! SHA256 state after hashing vchBlanked up to each input
+    std::vector<CSHA256> vMidstates;
+
+public:
+    //! Serialized size of an input with a blank script
+    static const size_t BLANK_INPUT_SIZE = 36 + 1 + 4;
+
+    explicit PrecomputedTransactionData(const CTransaction& txTo);
+
+    /**
+     * Compute the signature hash of input nIn, if nHashType is covered by
+     * the precomputed data. The caller has checked that nIn is in range.
+     */
+    bool SignatureHash(uint256& hash, const CScript& scriptCode, unsigned int nIn, int nHashType) const;
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* txdata = NULL);
 
 class BaseSignatureChecker
 {
@@ -96,12 +129,13 @@ class TransactionSignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction* txTo;
     unsigned int nIn;
+    const PrecomputedTransactionData* txdata;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const PrecomputedTransactionData* txdataIn = NULL) : txTo(txToIn), nIn(nInIn), txdata(txdataIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
 };
 
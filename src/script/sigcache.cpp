@@ -5,13 +5,18 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
+#include <algorithm>
+#include <limits>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace {
 
@@ -19,65 +24,151 @@ namespace {
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Rather than the signature data itself, the cache holds a 256-bit hash of
+ * it, salted with a random nonce so that nobody can predict where an entry
+ * will be stored. The table has a fixed size chosen at startup and is split
+ * into shards with their own lock, so the script check threads rarely wait
+ * on each other. Each shard is an array of small buckets; a full bucket
+ * evicts a pseudo-randomly chosen slot in constant time.
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const size_t NUM_SHARDS = 64;
+    static const size_t BUCKET_SIZE = 8;
+
+    struct Shard
+    {
+        boost::mutex cs;
+        //! nBuckets * BUCKET_SIZE entries, a null entry being an empty slot
+        std::vector<uint256> vEntries;
+        size_t nBuckets;
+        size_t nUsed;
+        uint64_t nHits;
+        uint64_t nMisses;
+
+        Shard() : nBuckets(0), nUsed(0), nHits(0), nMisses(0) {}
+    };
+
+    Shard shards[NUM_SHARDS];
+    unsigned char nonce[32];
+
+    uint256 ComputeEntry(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+    {
+        uint256 entry;
+        CSHA256().Write(nonce, sizeof(nonce)).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.empty() ? NULL : &vchSig[0], vchSig.size()).Finalize(entry.begin());
+        return entry;
+    }
+
+    Shard& GetShard(const uint256& entry) { return shards[ReadLE64(entry.begin()) % NUM_SHARDS]; }
+
+    //! First slot of the bucket entry belongs to in its shard.
+    static size_t GetBucket(const Shard& shard, const uint256& entry)
+    {
+        return (ReadLE64(entry.begin()) / NUM_SHARDS) % shard.nBuckets * BUCKET_SIZE;
+    }
 
 public:
+    CSignatureCache()
+    {
+        memset(nonce, 0, sizeof(nonce));
+    }
+
+    //! Size the cache to at most nBytes of entries, dropping all of them. Must not run concurrently with lookups.
+    size_t Resize(size_t nBytes)
+    {
+        GetRandBytes(nonce, sizeof(nonce));
+        size_t nBucketsPerShard = nBytes / (NUM_SHARDS * BUCKET_SIZE * sizeof(uint256));
+        for (size_t i = 0; i < NUM_SHARDS; i++) {
+            std::vector<uint256>(nBucketsPerShard * BUCKET_SIZE).swap(shards[i].vEntries);
+            shards[i].nBuckets = nBucketsPerShard;
+            shards[i].nUsed = 0;
+        }
+        return nBucketsPerShard * NUM_SHARDS * BUCKET_SIZE * sizeof(uint256);
+    }
+
     bool
     Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
+        uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+        Shard& shard = GetShard(entry);
+        boost::unique_lock<boost::mutex> lock(shard.cs);
+        if (shard.nBuckets) {
+            size_t nBucket = GetBucket(shard, entry);
+            for (size_t i = nBucket; i < nBucket + BUCKET_SIZE; i++) {
+                if (shard.vEntries[i] == entry) {
+                    shard.nHits++;
+                    return true;
+                }
+            }
+        }
+        shard.nMisses++;
         return false;
     }
 
     void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+        uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+        Shard& shard = GetShard(entry);
+        boost::unique_lock<boost::mutex> lock(shard.cs);
+        if (shard.nBuckets == 0)
+            return;
+
+        size_t nBucket = GetBucket(shard, entry);
+        size_t nSlot = BUCKET_SIZE;
+        for (size_t i = 0; i < BUCKET_SIZE; i++) {
+            const uint256& slot = shard.vEntries[nBucket + i];
+            if (slot == entry)
+                return;
+            if (slot.IsNull() && nSlot == BUCKET_SIZE)
+                nSlot = i;
         }
+        if (nSlot == BUCKET_SIZE) {
+            // Evict a slot picked by bits of the salted entry that did not
+            // select the bucket, which an attacker cannot steer.
+            nSlot = entry.begin()[8] % BUCKET_SIZE;
+        } else {
+            shard.nUsed++;
+        }
+        shard.vEntries[nBucket + nSlot] = entry;
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    void GetStats(CSignatureCacheStats& stats)
+    {
+        stats = CSignatureCacheStats();
+        for (size_t i = 0; i < NUM_SHARDS; i++) {
+            boost::unique_lock<boost::mutex> lock(shards[i].cs);
+            stats.nEntries += shards[i].nUsed;
+            stats.nCapacity += shards[i].vEntries.size();
+            stats.nHits += shards[i].nHits;
+            stats.nMisses += shards[i].nMisses;
+        }
+        stats.nBytes = stats.nCapacity * sizeof(uint256);
     }
 };
 
+CSignatureCache signatureCache;
+
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+void InitSignatureCache()
+{
+    // -maxsigcachesize is in MiB; the cache stays empty until sized here.
+    int64_t nMaxCacheSize = std::max((int64_t)0, std::min(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE));
+    // Compute the byte count in 64 bits so large values don't wrap size_t on 32-bit hosts.
+    uint64_t nRequested = (uint64_t)nMaxCacheSize << 20;
+    size_t nBytes = signatureCache.Resize((size_t)std::min(nRequested, (uint64_t)std::numeric_limits<size_t>::max()));
+    LogPrintf("Using %d MiB out of %d requested for signature cache\n", nBytes >> 20, nMaxCacheSize);
+}
+
+void GetSignatureCacheStats(CSignatureCacheStats& stats)
 {
-    static CSignatureCache signatureCache;
+    signatureCache.GetStats(stats);
+}
 
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
 
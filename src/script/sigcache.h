@@ -8,19 +8,42 @@
 
 #include "script/interpreter.h"
 
+#include <stdint.h>
 #include <vector>
 
 class CPubKey;
 
+/** Default for -maxsigcachesize, the size of the signature cache in MiB */
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+/** Maximum value for -maxsigcachesize */
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
+struct CSignatureCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    //! Number of signatures stored and room for them
+    size_t nEntries;
+    size_t nCapacity;
+    size_t nBytes;
+
+    CSignatureCacheStats() : nHits(0), nMisses(0), nEntries(0), nCapacity(0), nBytes(0) {}
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true, const PrecomputedTransactionData* txdataIn = NULL) : TransactionSignatureChecker(txToIn, nInIn, txdataIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Allocate the signature cache according to -maxsigcachesize. Until then, nothing is cached. */
+void InitSignatureCache();
+
+void GetSignatureCacheStats(CSignatureCacheStats& stats);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
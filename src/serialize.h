@@ -391,6 +391,13 @@ public:
         pbegin = (char*)begin_ptr(v);
         pend = (char*)end_ptr(v);
     }
+    //! For serializing only: a CFlatData made from const data must never be unserialized into.
+    template <class T, class TAl>
+    explicit CFlatData(const std::vector<T,TAl> &v)
+    {
+        pbegin = (char*)begin_ptr(v);
+        pend = (char*)end_ptr(v);
+    }
     char* begin() { return pbegin; }
     const char* begin() const { return pbegin; }
     char* end() { return pend; }
@@ -0,0 +1,229 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+/**
+ * A memory resource for many small allocations of similar size, such as the
+ * nodes of a node based container.
+ *
+ * Requests of up to MAX_BLOCK_SIZE_BYTES are carved out of large chunks,
+ * rounded up to a multiple of ALIGN_BYTES. Freed blocks are kept on a free
+ * list per rounded size and handed out again, so a container that keeps
+ * inserting and erasing equally sized nodes does not call malloc/free at all
+ * once it has grown. Chunks are only returned to the system as a whole: when
+ * the resource is destroyed, or by Release once no pooled block is in use.
+ * Larger requests (like the bucket array of a hash table) are passed on to
+ * ::operator new.
+ *
+ * The resource is not thread safe; every container should have its own.
+ */
+template <size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+class PoolResource : private boost::noncopyable
+{
+    /** A freed block; the list pointer lives in the freed memory itself. */
+    struct ListNode
+    {
+        ListNode* next;
+    };
+
+    /** Alignment and rounding unit of all pooled blocks. It must be able to hold a ListNode. */
+    static const size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > sizeof(ListNode) ? ALIGN_BYTES : sizeof(ListNode);
+
+    //! Size of the chunks requested from the system.
+    const size_t nChunkSizeBytes;
+
+    //! Free lists, indexed by block size in units of ELEM_ALIGN_BYTES.
+    std::vector<ListNode*> vFreeLists;
+
+    //! All chunks requested from the system.
+    std::vector<char*> vAllocatedChunks;
+
+    //! Untouched memory at the end of the newest chunk.
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+
+    //! Bytes handed out and not yet returned, pooled blocks at their rounded size.
+    size_t nBytesInUse;
+
+    //! Bytes currently allocated directly with ::operator new.
+    size_t nLargeBytes;
+
+    static size_t NumElemAlignBytes(size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(size_t bytes, size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void AddToFreeList(void* p, size_t nIndex)
+    {
+        ListNode* node = new (p) ListNode;
+        node->next = vFreeLists[nIndex];
+        vFreeLists[nIndex] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // The rest of the current chunk is too small for the request that
+        // needs a new chunk, but it can still serve smaller ones later.
+        size_t nRemaining = pAvailableEnd - pAvailableBegin;
+        if (nRemaining > 0)
+            AddToFreeList(pAvailableBegin, nRemaining / ELEM_ALIGN_BYTES);
+
+        char* pChunk = static_cast<char*>(::operator new(nChunkSizeBytes));
+        vAllocatedChunks.push_back(pChunk);
+        pAvailableBegin = pChunk;
+        pAvailableEnd = pChunk + nChunkSizeBytes;
+    }
+
+public:
+    explicit PoolResource(size_t nChunkSizeBytesIn = 256 * 1024) :
+        nChunkSizeBytes(NumElemAlignBytes(nChunkSizeBytesIn) * ELEM_ALIGN_BYTES),
+        vFreeLists(MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1, (ListNode*)NULL),
+        pAvailableBegin(NULL), pAvailableEnd(NULL), nBytesInUse(0), nLargeBytes(0)
+    {
+        assert(nChunkSizeBytes >= MAX_BLOCK_SIZE_BYTES);
+    }
+
+    ~PoolResource()
+    {
+        for (size_t i = 0; i < vAllocatedChunks.size(); i++)
+            ::operator delete(vAllocatedChunks[i]);
+    }
+
+    /**
+     * Return all chunks to the system. No pooled block may be in use; blocks
+     * passed on to ::operator new are not affected.
+     */
+    void Release()
+    {
+        assert(nBytesInUse == 0);
+        for (size_t i = 0; i < vAllocatedChunks.size(); i++)
+            ::operator delete(vAllocatedChunks[i]);
+        vAllocatedChunks.clear();
+        std::fill(vFreeLists.begin(), vFreeLists.end(), (ListNode*)NULL);
+        pAvailableBegin = NULL;
+        pAvailableEnd = NULL;
+    }
+
+    void* Allocate(size_t bytes, size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            void* p = ::operator new(bytes);
+            nLargeBytes += bytes;
+            return p;
+        }
+        const size_t nIndex = NumElemAlignBytes(bytes);
+        const size_t nRoundBytes = nIndex * ELEM_ALIGN_BYTES;
+        nBytesInUse += nRoundBytes;
+        if (vFreeLists[nIndex] != NULL) {
+            ListNode* node = vFreeLists[nIndex];
+            vFreeLists[nIndex] = node->next;
+            return node;
+        }
+        if (nRoundBytes > (size_t)(pAvailableEnd - pAvailableBegin))
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nRoundBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t bytes, size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete(p);
+            nLargeBytes -= bytes;
+            return;
+        }
+        const size_t nIndex = NumElemAlignBytes(bytes);
+        nBytesInUse -= nIndex * ELEM_ALIGN_BYTES;
+        AddToFreeList(p, nIndex);
+    }
+
+    //! Memory handed out by this resource and not yet returned to it.
+    size_t BytesInUse() const { return nBytesInUse + nLargeBytes; }
+
+    //! Memory this resource holds from the system, including free blocks.
+    size_t BytesAllocated() const { return vAllocatedChunks.size() * nChunkSizeBytes + nLargeBytes; }
+
+    size_t NumAllocatedChunks() const { return vAllocatedChunks.size(); }
+    size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+};
+
+/**
+ * Allocator that serves all its allocations from a PoolResource. Copies (and
+ * rebound copies, like the ones a container makes for its nodes) share the
+ * resource, which must outlive every container using it.
+ */
+template <class T, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES = sizeof(void*)>
+class PoolAllocator
+{
+    template <class U, size_t M, size_t A>
+    friend class PoolAllocator;
+
+public:
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* resourceIn) throw() : resource(resourceIn) {}
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) throw() : resource(other.resource) {}
+
+    T* allocate(size_t n, const void* hint = 0)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), boost::alignment_of<T>::value));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T), boost::alignment_of<T>::value);
+    }
+
+    void construct(T* p, const T& val) { new ((void*)p) T(val); }
+    void destroy(T* p) { p->~T(); }
+
+    T* address(T& x) const { return &x; }
+    const T* address(const T& x) const { return &x; }
+    size_t max_size() const throw() { return (size_t)-1 / sizeof(T); }
+
+    ResourceType* GetResource() const { return resource; }
+
+    template <class U>
+    bool operator==(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) const { return resource == other.resource; }
+    template <class U>
+    bool operator!=(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) const { return resource != other.resource; }
+
+private:
+    ResourceType* resource;
+};
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -0,0 +1,239 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstorage.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "pow.h"
+#include "streams.h"
+#include "utiltime.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+/** Writes a few blocks to their own block files, with a block index entry for each. */
+struct BlockStorageSetup : public TestingSetup {
+    std::vector<CBlock> vBlocks;
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vIndex;
+
+    BlockStorageSetup()
+    {
+        // Regtest's proof of work limit lets these blocks pass ReadBlockFromDisk's check.
+        SelectParams(CBaseChainParams::REGTEST);
+        const int nBlocks = 6;
+        vBlocks.resize(nBlocks);
+        vHashes.resize(nBlocks);
+        vIndex.resize(nBlocks);
+        for (int i = 0; i < nBlocks; i++) {
+            CBlock& block = vBlocks[i];
+            block.nVersion = 1;
+            block.nTime = i + 1;
+            block.nBits = 0x207fffff;
+            while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, Params().GetConsensus()))
+                block.nNonce++;
+            CDiskBlockPos pos(i + 1, 0);
+            BOOST_REQUIRE(WriteBlockToDisk(block, pos, Params().MessageStart()));
+            vHashes[i] = block.GetHash();
+            vIndex[i] = CBlockIndex(block);
+            vIndex[i].phashBlock = &vHashes[i];
+            vIndex[i].nFile = pos.nFile;
+            vIndex[i].nDataPos = pos.nPos;
+            vIndex[i].nStatus |= BLOCK_HAVE_DATA;
+        }
+    }
+
+    ~BlockStorageSetup()
+    {
+        SelectParams(CBaseChainParams::MAIN);
+    }
+
+    std::vector<const CBlockIndex*> Window(int nBegin, int nEnd) const
+    {
+        std::vector<const CBlockIndex*> vpindex;
+        for (int i = nBegin; i < nEnd; i++)
+            vpindex.push_back(&vIndex[i]);
+        return vpindex;
+    }
+};
+
+/** Request a window of blocks until its last block has been read ahead. */
+bool RequestAndWait(CBlockReadAhead& readahead, const std::vector<const CBlockIndex*>& vpindex)
+{
+    for (int i = 0; i < 10000; i++) {
+        // Requests made before the worker has started are ignored, so repeat it.
+        readahead.Request(vpindex);
+        if (readahead.IsReady(vpindex.back()->GetBlockHash()))
+            return true;
+        MilliSleep(1);
+    }
+    return false;
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(blockstorage_tests, BlockStorageSetup)
+
+BOOST_AUTO_TEST_CASE(block_read_ahead)
+{
+    LOCK(cs_main);
+    CBlockReadAhead readahead;
+
+    // Without worker threads nothing is read ahead, but blocks can still be read.
+    readahead.Request(Window(0, 4));
+    BOOST_CHECK(!readahead.IsReady(vHashes[0]));
+    boost::shared_ptr<CBlock> pblock = readahead.Read(&vIndex[0]);
+    BOOST_REQUIRE(pblock);
+    BOOST_CHECK(pblock->GetHash() == vHashes[0]);
+
+    boost::thread thread(boost::bind(&CBlockReadAhead::Thread, &readahead));
+
+    // A single worker reads the blocks in the order they will be connected.
+    BOOST_REQUIRE(RequestAndWait(readahead, Window(0, 4)));
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK(readahead.IsReady(vHashes[i]));
+    BOOST_CHECK(!readahead.IsReady(vHashes[4]));
+
+    // Moving the window drops the blocks left behind and reads the new ones.
+    BOOST_REQUIRE(RequestAndWait(readahead, Window(2, 6)));
+    BOOST_CHECK(!readahead.IsReady(vHashes[0]));
+    BOOST_CHECK(!readahead.IsReady(vHashes[1]));
+    for (int i = 2; i < 6; i++)
+        BOOST_CHECK(readahead.IsReady(vHashes[i]));
+
+    // Each block is handed out once; a dropped one is read from disk again.
+    for (int i = 0; i < 6; i++) {
+        pblock = readahead.Read(&vIndex[i]);
+        BOOST_REQUIRE(pblock);
+        BOOST_CHECK(pblock->GetHash() == vHashes[i]);
+        BOOST_CHECK(!readahead.IsReady(vHashes[i]));
+    }
+
+    // A block that is not where its index says can't be read, ahead or not.
+    CBlockIndex indexWrong = vIndex[0];
+    indexWrong.phashBlock = &vHashes[1];
+    readahead.Request(std::vector<const CBlockIndex*>(1, &indexWrong));
+    BOOST_CHECK(!readahead.Read(&indexWrong));
+
+    thread.interrupt();
+    thread.join();
+}
+
+/** Read all blocks of the files from a scanner, checking that each was found where it is. */
+static std::vector<std::vector<uint256> > ScanAll(CReindexScanner& scanner, int nFiles)
+{
+    std::vector<std::vector<uint256> > vFileHashes(nFiles);
+    for (int nFile = 0; nFile < nFiles; nFile++) {
+        CReindexScanner::CScannedBlock scanned;
+        while (scanner.Next(nFile, scanned)) {
+            BOOST_CHECK_EQUAL(scanned.pos.nFile, nFile);
+            BOOST_CHECK(scanned.pblock->GetHash() == scanned.hash);
+            BOOST_CHECK_EQUAL(scanned.nSize, ::GetSerializeSize(*scanned.pblock, SER_DISK, CLIENT_VERSION));
+            CBlock block;
+            BOOST_CHECK(ReadBlockFromDisk(block, scanned.pos) && block.GetHash() == scanned.hash);
+            vFileHashes[nFile].push_back(scanned.hash);
+        }
+    }
+    return vFileHashes;
+}
+
+BOOST_AUTO_TEST_CASE(reindex_scanner)
+{
+    // Append two more blocks to the first file. The genesis block in file 0
+    // was written with main's message start, so it is not found on regtest.
+    for (int i = 4; i < 6; i++) {
+        CDiskBlockPos pos(1, boost::filesystem::file_size(GetBlockPosFilename(CDiskBlockPos(1, 0), "blk")));
+        BOOST_REQUIRE(WriteBlockToDisk(vBlocks[i], pos, Params().MessageStart()));
+    }
+    const int nFiles = 7;
+    std::vector<std::vector<uint256> > vExpected(nFiles);
+    vExpected[1].push_back(vHashes[0]);
+    vExpected[1].push_back(vHashes[4]);
+    vExpected[1].push_back(vHashes[5]);
+    for (int i = 1; i < 6; i++)
+        vExpected[i + 1].push_back(vHashes[i]);
+
+    // Several threads scanning ahead hand over the blocks in file order.
+    {
+        CReindexScanner scanner(nFiles, 2);
+        boost::thread_group threads;
+        for (int i = 0; i < 3; i++)
+            threads.create_thread(boost::bind(&CReindexScanner::Thread, &scanner));
+        BOOST_CHECK(ScanAll(scanner, nFiles) == vExpected);
+        scanner.Stop();
+        threads.join_all();
+    }
+
+    // Without a window no file is scanned before it is being imported, so a
+    // file removed after the previous one was imported is not found.
+    {
+        CReindexScanner scanner(nFiles, 0);
+        boost::thread_group threads;
+        for (int i = 0; i < 2; i++)
+            threads.create_thread(boost::bind(&CReindexScanner::Thread, &scanner));
+        CReindexScanner::CScannedBlock scanned;
+        BOOST_CHECK(!scanner.Next(0, scanned));
+        for (size_t i = 0; i < vExpected[1].size(); i++) {
+            BOOST_REQUIRE(scanner.Next(1, scanned));
+            BOOST_CHECK(scanned.hash == vExpected[1][i]);
+        }
+        BOOST_CHECK(!scanner.Next(1, scanned));
+        BOOST_REQUIRE(boost::filesystem::remove(GetBlockPosFilename(CDiskBlockPos(2, 0), "blk")));
+        BOOST_CHECK(!scanner.Next(2, scanned));
+        BOOST_REQUIRE(scanner.Next(3, scanned));
+        BOOST_CHECK(scanned.hash == vHashes[2]);
+        scanner.Stop();
+        threads.join_all();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(recent_blocks)
+{
+    LOCK(cs_main);
+    CRecentBlocks recent;
+    std::vector<boost::shared_ptr<const CBlock> > vpblocks;
+    for (size_t i = 0; i < RECENT_BLOCKS_SIZE + 2; i++) {
+        boost::shared_ptr<CBlock> pblock(new CBlock());
+        pblock->nTime = i + 1;
+        vpblocks.push_back(pblock);
+    }
+
+    BOOST_CHECK(!recent.Get(vpblocks[0]->GetHash()));
+    BOOST_CHECK(!recent.GetSerialized(vpblocks[0]->GetHash()));
+    for (size_t i = 0; i < RECENT_BLOCKS_SIZE; i++)
+        recent.Add(vpblocks[i]);
+    for (size_t i = 0; i < RECENT_BLOCKS_SIZE; i++)
+        BOOST_CHECK(recent.Get(vpblocks[i]->GetHash()) == vpblocks[i]);
+
+    // A block is serialized once, when it is first asked for.
+    boost::shared_ptr<const std::vector<char> > pvch = recent.GetSerialized(vpblocks[1]->GetHash());
+    BOOST_REQUIRE(pvch);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *vpblocks[1];
+    BOOST_CHECK(*pvch == std::vector<char>(ss.begin(), ss.end()));
+    BOOST_CHECK(recent.GetSerialized(vpblocks[1]->GetHash()) == pvch);
+
+    // Adding a block again changes nothing; new blocks push out the oldest ones.
+    recent.Add(vpblocks[0]);
+    recent.Add(vpblocks[RECENT_BLOCKS_SIZE]);
+    recent.Add(vpblocks[RECENT_BLOCKS_SIZE + 1]);
+    BOOST_CHECK(!recent.Get(vpblocks[0]->GetHash()));
+    BOOST_CHECK(!recent.Get(vpblocks[1]->GetHash()));
+    BOOST_CHECK(!recent.GetSerialized(vpblocks[1]->GetHash()));
+    for (size_t i = 2; i < RECENT_BLOCKS_SIZE + 2; i++)
+        BOOST_CHECK(recent.Get(vpblocks[i]->GetHash()) == vpblocks[i]);
+    // A block handed out stays valid after it has been pushed out.
+    BOOST_CHECK_EQUAL(pvch->size(), ss.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,8 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "clientversion.h"
 #include "random.h"
+#include "script/standard.h"
 #include "uint256.h"
+#include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
 #include <vector>
@@ -14,45 +17,61 @@
 
 namespace
 {
+bool operator==(const Coin &a, const Coin &b) {
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.nHeight == b.nHeight &&
+           a.nVersion == b.nVersion &&
+           a.out == b.out;
+}
+
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin) && !coin.IsSpent();
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                // Same optimization used in CCoinsViewDB is to only write dirty entries.
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
+                    // Randomly delete empty entries on write.
+                    map_.erase(it->first);
+                }
             }
-            mapCoins.erase(it++);
+            if (fErase)
+                mapCoins.erase(it++);
+            else
+                it++;
         }
-        mapCoins.clear();
+        if (fErase)
+            mapCoins.clear();
         hashBestBlock_ = hashBlock;
         return true;
     }
@@ -70,11 +89,12 @@ public:
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += memusage::DynamicUsage(it->second.coins);
+            ret += it->second.coin.DynamicMemoryUsage();
         }
-        BOOST_CHECK_EQUAL(memusage::DynamicUsage(*this), ret);
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
+    size_t PoolBytesAllocated() const { return cacheCoinsMemoryResource.BytesAllocated(); }
 };
 
 }
@@ -86,8 +106,8 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
-// txids picked from a limited list of random 256-bit hashes. Occasionally, a
+// It will randomly create/update/delete Coin entries to a tip of caches, with
+// outpoints picked from a limited list of random 256-bit txids. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
 // During the process, booleans are kept to make sure that the randomized
@@ -102,9 +122,11 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool synced_a_cache = false;
+    bool trimmed_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -121,37 +143,43 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
         // Do a random modification.
         {
-            uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
+            // Outpoint we're going to modify in this iteration.
+            COutPoint outpoint(txids[insecure_rand() % txids.size()], insecure_rand() % 2);
+            Coin& coin = result[outpoint];
+            const Coin& entry = stack.back()->AccessCoin(outpoint);
+            BOOST_CHECK(coin == entry);
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                bool fPossibleOverwrite = !coin.IsSpent();
+                if (coin.IsSpent()) {
                     added_an_entry = true;
                 } else {
                     updated_an_entry = true;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                coin.nVersion = insecure_rand();
+                coin.nHeight = insecure_rand() % 1000000;
+                coin.fCoinBase = insecure_rand() % 2;
+                coin.out.nValue = insecure_rand();
+                coin.out.scriptPubKey.assign(insecure_rand() % 64, 0);
+                stack.back()->AddCoin(outpoint, coin, fPossibleOverwrite);
             } else {
-                coins.Clear();
-                entry->Clear();
+                coin.Clear();
+                BOOST_CHECK(stack.back()->SpendCoin(outpoint));
                 removed_an_entry = true;
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -159,6 +187,18 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             }
         }
 
+        if (insecure_rand() % 100 == 0) {
+            // Every 100 iterations, write a random cache to its base while keeping
+            // its entries, or evict clean entries from it.
+            CCoinsViewCacheTest* cache = stack[insecure_rand() % stack.size()];
+            if (insecure_rand() % 2) {
+                BOOST_CHECK(cache->Sync());
+                synced_a_cache = true;
+            } else if (cache->Trim(cache->DynamicMemoryUsage() / 2) > 0) {
+                trimmed_a_cache = true;
+            }
+        }
+
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
@@ -195,6 +235,169 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(synced_a_cache);
+    BOOST_CHECK(trimmed_a_cache);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    CCoinsCacheStats stats;
+
+    std::vector<COutPoint> outpoints;
+    for (unsigned int i = 0; i < 100; i++) {
+        outpoints.push_back(COutPoint(GetRandHash(), i % 3));
+        CTxOut out(i + 1, CScript() << i);
+        cache.AddCoin(outpoints.back(), Coin(out, i, false, 1), false);
+    }
+
+    // Dirty entries are never evicted.
+    BOOST_CHECK_EQUAL(cache.Trim(0), 0U);
+    cache.GetCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 100U);
+    BOOST_CHECK_EQUAL(stats.nDirtyEntries, 100U);
+    BOOST_CHECK(stats.nDirtyUsage > 0);
+
+    // Syncing writes them to the base but keeps them cached as clean entries.
+    BOOST_CHECK(cache.Sync());
+    cache.GetCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 100U);
+    BOOST_CHECK_EQUAL(stats.nDirtyEntries, 0U);
+    BOOST_CHECK_EQUAL(stats.nDirtyUsage, 0U);
+    BOOST_CHECK(base.HaveCoin(outpoints[0]));
+    cache.SelfTest();
+
+    // Clean entries can be evicted, and are fetched from the base again afterwards.
+    BOOST_CHECK_EQUAL(cache.Trim(0), 100U);
+    cache.SelfTest();
+    cache.GetCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 0U);
+    BOOST_CHECK_EQUAL(stats.nEvicted, 100U);
+    uint64_t nMisses = stats.nMisses, nHits = stats.nHits;
+    for (unsigned int i = 0; i < outpoints.size(); i++)
+        BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[i]).out.nValue, i + 1);
+    for (unsigned int i = 0; i < outpoints.size(); i++)
+        BOOST_CHECK(cache.HaveCoin(outpoints[i]));
+    cache.GetCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nMisses, nMisses + 100);
+    BOOST_CHECK_EQUAL(stats.nHits, nHits + 100);
+
+    // Entries used since the clock hand last passed them get a second chance:
+    // once every reference bit is cleared, using one entry keeps it cached
+    // until all others are evicted.
+    BOOST_CHECK_EQUAL(cache.Trim(cache.DynamicMemoryUsage() - 1), 1U);
+    const COutPoint* pused = NULL;
+    for (unsigned int i = 0; i < outpoints.size() && !pused; i++) {
+        if (cache.HaveCoinInCache(outpoints[i]))
+            pused = &outpoints[i];
+    }
+    BOOST_CHECK(pused != NULL);
+    cache.AccessCoin(*pused);
+    while (cache.GetCacheSize() > 1)
+        BOOST_CHECK_EQUAL(cache.Trim(cache.DynamicMemoryUsage() - 1), 1U);
+    BOOST_CHECK(cache.HaveCoinInCache(*pused));
+
+    // Spent entries are dropped once the spend has been written.
+    BOOST_CHECK(cache.SpendCoin(outpoints[0]));
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[0]));
+    BOOST_CHECK(!base.HaveCoin(outpoints[0]));
+    cache.SelfTest();
+}
+
+// Memory freed by evicting or flushing entries is given back, not kept in the pool.
+BOOST_AUTO_TEST_CASE(coins_cache_releases_memory)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    std::vector<COutPoint> outpoints;
+    for (unsigned int i = 0; i < 20000; i++) {
+        outpoints.push_back(COutPoint(GetRandHash(), 0));
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript()), i, false, 1), false);
+    }
+    size_t nPeak = cache.PoolBytesAllocated();
+    BOOST_CHECK(cache.Sync());
+
+    // Evicting most entries moves the rest onto fewer chunks.
+    cache.Trim(cache.DynamicMemoryUsage() / 4);
+    BOOST_CHECK(cache.GetCacheSize() > 0);
+    BOOST_CHECK(cache.PoolBytesAllocated() < nPeak / 2);
+    cache.SelfTest();
+    for (unsigned int i = 0; i < outpoints.size(); i++)
+        BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[i]).out.nValue, i + 1);
+
+    // An emptied cache holds no pool memory at all.
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK_EQUAL(cache.PoolBytesAllocated(), 0U);
+    BOOST_CHECK(base.HaveCoin(outpoints[0]));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_emplace_from_base)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    COutPoint outpoint(GetRandHash(), 1);
+    Coin coin(CTxOut(1000, CScript() << OP_TRUE), 10, false, 1);
+
+    // A prefetched coin is cached as clean: there is nothing to write back.
+    Coin prefetched = coin;
+    BOOST_CHECK(cache.EmplaceCoinFromBase(outpoint, prefetched));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK(cache.AccessCoin(outpoint) == coin);
+    CCoinsCacheStats stats;
+    cache.GetCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nDirtyEntries, 0U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 1U);
+    cache.SelfTest();
+
+    // Entries that are already cached are left alone.
+    Coin other(CTxOut(2000, CScript() << OP_TRUE), 11, false, 1);
+    BOOST_CHECK(!cache.EmplaceCoinFromBase(outpoint, other));
+    BOOST_CHECK(cache.AccessCoin(outpoint) == coin);
+}
+
+BOOST_AUTO_TEST_CASE(coin_serialization)
+{
+    // Coinbase output at height 6, transaction version 1, P2PKH to 816115944e077fe7c803cfa57f29b36bf87c1d35.
+    CDataStream ss1(ParseHex("0d010000816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin c1;
+    ss1 >> c1;
+    BOOST_CHECK_EQUAL(c1.fCoinBase, true);
+    BOOST_CHECK_EQUAL(c1.nHeight, 6U);
+    BOOST_CHECK_EQUAL(c1.nVersion, 1);
+    BOOST_CHECK_EQUAL(c1.out.nValue, 0);
+    BOOST_CHECK_EQUAL(HexStr(c1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+
+    // Round trip.
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << c1;
+    BOOST_CHECK_EQUAL(HexStr(ss2.begin(), ss2.end()), "0d010000816115944e077fe7c803cfa57f29b36bf87c1d35");
+
+    // Non-coinbase output at height 120891, version 2, with a larger value.
+    Coin c2;
+    c2.nHeight = 120891;
+    c2.nVersion = 2;
+    c2.out.nValue = 110397;
+    c2.out.scriptPubKey = GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))));
+    CDataStream ss3(SER_DISK, CLIENT_VERSION);
+    ss3 << c2;
+    Coin c3;
+    ss3 >> c3;
+    BOOST_CHECK(c3 == c2);
+    BOOST_CHECK_EQUAL(c3.fCoinBase, false);
+    BOOST_CHECK_EQUAL(c3.nHeight, 120891U);
+
+    // Unknown script type with a truncated body must fail to decode.
+    CDataStream ss4(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    try {
+        Coin c4;
+        ss4 >> c4;
+        BOOST_CHECK_MESSAGE(false, "We should have thrown");
+    } catch (const std::ios_base::failure& e) {
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
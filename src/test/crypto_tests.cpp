@@ -2,12 +2,21 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "crypto/common.h"
+#include "crypto/cpuid.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/hashskein.h"
+#include "hash.h"
+#include "primitives/block.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -17,6 +26,27 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/test/unit_test.hpp>
 
+// The instruction set specific kernels, which SHA256AutoDetect() picks at most
+// one of; declared here so that each of them is tested on any capable host.
+#ifdef ENABLE_SSE41
+namespace hashskein_sse41
+{
+void Sha256D64_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+#ifdef ENABLE_AVX2
+namespace hashskein_avx2
+{
+void Sha256D64_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+#ifdef ENABLE_SHANI
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+#endif
+
 BOOST_FIXTURE_TEST_SUITE(crypto_tests, BasicTestingSetup)
 
 template<typename Hasher, typename In, typename Out>
@@ -131,6 +161,77 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256_selftest) {
+    BOOST_CHECK(!SHA256AutoDetect().empty());
+    BOOST_CHECK(SHA256SelfTest());
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64) {
+    for (int i = 0; i <= 32; i++) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; j++)
+            in[j] = insecure_rand();
+        for (int j = 0; j < i; j++)
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+/** Compare a multi-lane double-SHA256 kernel against CHash256. */
+static void TestSHA256D64Kernel(void (*kernel)(unsigned char*, const unsigned char*), int ways)
+{
+    for (int n = 0; n < 10; n++) {
+        std::vector<unsigned char> in(64 * ways), out1(32 * ways), out2(32 * ways);
+        for (size_t j = 0; j < in.size(); j++)
+            in[j] = insecure_rand();
+        for (int j = 0; j < ways; j++)
+            CHash256().Write(&in[64 * j], 64).Finalize(&out1[32 * j]);
+        kernel(&out2[0], &in[0]);
+        BOOST_CHECK(out1 == out2);
+    }
+}
+
+#ifdef ENABLE_SHANI
+/** Run the SHA-NI transform over a message padded to whole chunks, and compare with the expected digest. */
+static void TestSHA256ShaniTransform(const std::string& msg, const std::string& hexout)
+{
+    std::vector<unsigned char> padded(msg.begin(), msg.end());
+    padded.push_back(0x80);
+    while (padded.size() % 64 != 56)
+        padded.push_back(0);
+    uint64_t nBits = msg.size() * 8;
+    for (int i = 7; i >= 0; i--)
+        padded.push_back((unsigned char)(nBits >> (8 * i)));
+
+    uint32_t s[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+    sha256_shani::Transform(s, &padded[0], padded.size() / 64);
+    std::vector<unsigned char> hash(32);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(&hash[4 * i], s[i]);
+    BOOST_CHECK_EQUAL(HexStr(hash), hexout);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(sha256_kernels) {
+#ifdef ENABLE_SSE41
+    if (cpuid::HasSSE41())
+        TestSHA256D64Kernel(hashskein_sse41::Sha256D64_4way, 4);
+#endif
+#ifdef ENABLE_AVX2
+    if (cpuid::HasAVX2())
+        TestSHA256D64Kernel(hashskein_avx2::Sha256D64_8way, 8);
+#endif
+#ifdef ENABLE_SHANI
+    if (cpuid::HasSHANI()) {
+        TestSHA256ShaniTransform("abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        TestSHA256ShaniTransform("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                                 "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    }
+#endif
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -248,4 +349,62 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+BOOST_AUTO_TEST_CASE(skein_header_midstate) {
+    for (int i = 0; i < 64; i++) {
+        CBlockHeader header;
+        header.nVersion = insecure_rand();
+        header.hashPrevBlock = GetRandHash();
+        header.hashMerkleRoot = GetRandHash();
+        header.nTime = insecure_rand();
+        header.nBits = insecure_rand();
+        header.nNonce = insecure_rand();
+
+        const unsigned char* pheader = (const unsigned char*)BEGIN(header.nVersion);
+        const CSkeinHeaderMidstate midstate(pheader);
+        for (int j = 0; j < 16; j++) {
+            // The same midstate must serve every nonce/time of the template.
+            header.nNonce += insecure_rand() % 1000 + 1;
+            if (j & 1)
+                header.nTime++;
+            BOOST_CHECK(midstate.Finalize(pheader + CSkeinHeaderMidstate::PREFIX_SIZE) == header.GetPoWHash());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(skein_header_batch) {
+    SkeinAutoDetect();
+    for (size_t count = 1; count < 20; count++) {
+        std::vector<CBlockHeader> headers(count);
+        std::vector<unsigned char> vHeaders(count * CSkeinHeaderMidstate::HEADER_SIZE);
+        std::vector<unsigned char> vTails(count * CSkeinHeaderMidstate::TAIL_SIZE);
+        for (size_t i = 0; i < count; i++) {
+            headers[i].nVersion = insecure_rand();
+            headers[i].hashPrevBlock = GetRandHash();
+            headers[i].hashMerkleRoot = i ? headers[0].hashMerkleRoot : GetRandHash();
+            headers[i].nTime = insecure_rand();
+            headers[i].nBits = insecure_rand();
+            headers[i].nNonce = insecure_rand();
+            const unsigned char* pheader = (const unsigned char*)BEGIN(headers[i].nVersion);
+            memcpy(&vHeaders[i * CSkeinHeaderMidstate::HEADER_SIZE], pheader, CSkeinHeaderMidstate::HEADER_SIZE);
+            memcpy(&vTails[i * CSkeinHeaderMidstate::TAIL_SIZE], pheader + CSkeinHeaderMidstate::PREFIX_SIZE, CSkeinHeaderMidstate::TAIL_SIZE);
+        }
+
+        std::vector<unsigned char> vHashes(count * 32);
+        HashSkeinHeaders(&vHashes[0], &vHeaders[0], count);
+        for (size_t i = 0; i < count; i++)
+            BOOST_CHECK(uint256(std::vector<unsigned char>(&vHashes[i * 32], &vHashes[i * 32] + 32)) == headers[i].GetPoWHash());
+
+        // Tails of other headers, all finalized from the first header's midstate.
+        const CSkeinHeaderMidstate midstate((const unsigned char*)BEGIN(headers[0].nVersion));
+        CBlockHeader expected = headers[0];
+        midstate.FinalizeBatch(&vHashes[0], &vTails[0], count);
+        for (size_t i = 0; i < count; i++) {
+            expected.nTime = headers[i].nTime;
+            expected.nBits = headers[i].nBits;
+            expected.nNonce = headers[i].nNonce;
+            BOOST_CHECK(uint256(std::vector<unsigned char>(&vHashes[i * 32], &vHashes[i * 32] + 32)) == expected.GetPoWHash());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
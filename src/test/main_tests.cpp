@@ -4,6 +4,8 @@
 
 #include "chainparams.h"
 #include "main.h"
+#include "random.h"
+#include "streams.h"
 
 #include "test/test_bitcoin.h"
 
@@ -73,4 +75,70 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(read_raw_block)
+{
+    // The genesis block was written to disk by the test setup.
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex != NULL);
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindex));
+    std::vector<char> vchBlock;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(vchBlock, pindex));
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(std::vector<char>(ss.begin(), ss.end()) == vchBlock);
+}
+
+/** Add a block index entry on top of pprev to mapBlockIndex, which owns it. */
+static CBlockIndex* AddBlockIndex(CBlockIndex* pprev)
+{
+    CBlockIndex* pindex = new CBlockIndex();
+    pindex->pprev = pprev;
+    pindex->nHeight = pprev->nHeight + 1;
+    BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(GetRandHash(), pindex)).first;
+    pindex->phashBlock = &mi->first;
+    pindex->BuildSkip();
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(assume_valid)
+{
+    LOCK(cs_main);
+    // A chain of 20 blocks on top of genesis, and a fork off its 10th block.
+    std::vector<CBlockIndex*> vChain(1, chainActive.Genesis());
+    for (int i = 0; i < 20; i++)
+        vChain.push_back(AddBlockIndex(vChain.back()));
+    std::vector<CBlockIndex*> vFork(1, vChain[10]);
+    for (int i = 0; i < 15; i++)
+        vFork.push_back(AddBlockIndex(vFork.back()));
+    pindexBestHeader = vChain.back();
+
+    // Without -assumevalid every block's scripts are checked.
+    BOOST_CHECK(hashAssumeValid.IsNull());
+    BOOST_CHECK(!IsAssumedValid(vChain[5]));
+
+    // Scripts are skipped up to the assumed valid block and checked after it.
+    hashAssumeValid = vChain[15]->GetBlockHash();
+    for (int i = 1; i <= 20; i++)
+        BOOST_CHECK_EQUAL(IsAssumedValid(vChain[i]), i <= 15);
+    // Blocks on another branch are checked.
+    for (int i = 1; i <= 15; i++)
+        BOOST_CHECK(!IsAssumedValid(vFork[i]));
+
+    // When the assumed valid block is not in the best header chain, only the
+    // ancestors it shares with that chain are skipped.
+    pindexBestHeader = vFork.back();
+    for (int i = 1; i <= 20; i++)
+        BOOST_CHECK_EQUAL(IsAssumedValid(vChain[i]), i <= 10);
+    pindexBestHeader = vChain.back();
+
+    // Nor when it is unknown.
+    hashAssumeValid = GetRandHash();
+    BOOST_CHECK(!IsAssumedValid(vChain[5]));
+
+    hashAssumeValid.SetNull();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
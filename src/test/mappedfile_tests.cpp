@@ -0,0 +1,122 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <boost/weak_ptr.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mappedfile_tests, TestingSetup)
+
+static void AppendToFile(const boost::filesystem::path& path, const CDataStream& ss)
+{
+    FILE* file = fopen(path.string().c_str(), "ab");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_REQUIRE_EQUAL(fwrite(&ss[0], 1, ss.size(), file), ss.size());
+    fclose(file);
+}
+
+static void ReleaseLater(boost::shared_ptr<const CMappedFile>* ppfile)
+{
+    MilliSleep(50);
+    ppfile->reset();
+}
+
+BOOST_AUTO_TEST_CASE(memory_reader)
+{
+    std::vector<int> v;
+    v.push_back(1);
+    v.push_back(-2);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << v << std::string("end");
+
+    CMemoryReader reader(&ss[0], &ss[0] + ss.size(), SER_DISK, CLIENT_VERSION);
+    std::vector<int> vRead;
+    std::string strRead;
+    reader >> vRead >> strRead;
+    BOOST_CHECK(vRead == v);
+    BOOST_CHECK_EQUAL(strRead, "end");
+    BOOST_CHECK(reader.empty());
+
+    // Reading past the end throws instead of touching memory outside the range.
+    int nRead;
+    BOOST_CHECK_THROW(reader >> nRead, std::ios_base::failure);
+    CMemoryReader reader2(&ss[0], &ss[0] + 2, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(reader2 >> vRead, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(mapped_file_cache)
+{
+    boost::filesystem::path path1 = GetDataDir() / "mapped1.dat";
+    boost::filesystem::path path2 = GetDataDir() / "mapped2.dat";
+    CMappedFileCache cache(1);
+
+    // Missing files can't be mapped.
+    BOOST_CHECK(!cache.Get(path1, 0));
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << std::string("first");
+    AppendToFile(path1, ss);
+    boost::shared_ptr<const CMappedFile> pfile = cache.Get(path1, ss.size());
+    BOOST_REQUIRE(pfile);
+    BOOST_CHECK_EQUAL(pfile->size(), ss.size());
+    BOOST_CHECK(memcmp(pfile->data(), &ss[0], ss.size()) == 0);
+    BOOST_CHECK(cache.Get(path1, 1) == pfile);
+    // Nothing beyond the end of the file.
+    BOOST_CHECK(!cache.Get(path1, ss.size() + 1));
+
+    // Data appended later is found by mapping the file again.
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << std::string("second");
+    AppendToFile(path1, ss2);
+    boost::shared_ptr<const CMappedFile> pfile2 = cache.Get(path1, ss.size() + ss2.size());
+    BOOST_REQUIRE(pfile2);
+    BOOST_CHECK(pfile2 != pfile);
+    std::string str1, str2;
+    CMemoryReader reader(pfile2->data(), pfile2->data() + pfile2->size(), SER_DISK, CLIENT_VERSION);
+    reader >> str1 >> str2;
+    BOOST_CHECK_EQUAL(str1, "first");
+    BOOST_CHECK_EQUAL(str2, "second");
+    // The old mapping is still usable.
+    BOOST_CHECK(memcmp(pfile->data(), &ss[0], ss.size()) == 0);
+
+    // Only the most recently used file stays mapped.
+    AppendToFile(path2, ss);
+    boost::shared_ptr<const CMappedFile> pfileOther = cache.Get(path2, 1);
+    BOOST_REQUIRE(pfileOther);
+    BOOST_CHECK(cache.Get(path1, 1) != pfile2);
+
+    // Removing a file waits for its mapping to be released by everyone.
+    boost::weak_ptr<const CMappedFile> pweakOther = pfileOther;
+    boost::thread thread(boost::bind(&ReleaseLater, &pfileOther));
+    cache.Remove(path2);
+    BOOST_CHECK(pweakOther.expired());
+    thread.join();
+
+    // A mapping is never handed out for more than the file has now.
+    pfile2 = cache.Get(path1, 1);
+    BOOST_REQUIRE(pfile2);
+    boost::filesystem::resize_file(path1, ss.size());
+    BOOST_CHECK(!cache.Get(path1, ss.size() + 1));
+    pfile = cache.Get(path1, 1);
+    BOOST_REQUIRE(pfile);
+    BOOST_CHECK(pfile != pfile2);
+    BOOST_CHECK_EQUAL(pfile->size(), ss.size());
+    boost::filesystem::remove(path1);
+    BOOST_CHECK(!cache.Get(path1, 1));
+    cache.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
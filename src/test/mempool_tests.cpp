@@ -2,7 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "coins.h"
+#include "consensus/validation.h"
 #include "main.h"
+#include "script/standard.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -101,4 +104,572 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+template<typename name>
+void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder)
+{
+    BOOST_CHECK_EQUAL(pool.size(), sortedOrder.size());
+    typename CTxMemPool::indexed_transaction_set::index<name>::type::iterator it = pool.mapTx.get<name>().begin();
+    int count=0;
+    for (; it != pool.mapTx.get<name>().end(); ++it, ++count) {
+        BOOST_CHECK_EQUAL(it->GetTx().GetHash().ToString(), sortedOrder[count]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    /* 3rd highest fee */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 0, 10.0, 1, true));
+
+    /* highest fee */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 20000LL, 0, 9.0, 1, true));
+
+    /* lowest fee */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0LL, 0, 100.0, 1, true));
+
+    /* 2nd highest fee */
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx4.vout[0].nValue = 6 * COIN;
+    pool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 15000LL, 0, 1.0, 1, true));
+
+    /* equal fee rate to tx1, but newer */
+    CMutableTransaction tx5 = CMutableTransaction();
+    tx5.vout.resize(1);
+    tx5.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx5.vout[0].nValue = 11 * COIN;
+    pool.addUnchecked(tx5.GetHash(), CTxMemPoolEntry(tx5, 10000LL, 1, 10.0, 1, true));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    // Lowest descendant score first; ties are broken by evicting the newer tx
+    std::vector<std::string> sortedOrder;
+    sortedOrder.resize(5);
+    sortedOrder[0] = tx3.GetHash().ToString(); // 0
+    sortedOrder[1] = tx5.GetHash().ToString(); // 10000
+    sortedOrder[2] = tx1.GetHash().ToString(); // 10000
+    sortedOrder[3] = tx4.GetHash().ToString(); // 15000
+    sortedOrder[4] = tx2.GetHash().ToString(); // 20000
+    CheckSort<descendant_score>(pool, sortedOrder);
+
+    /* low fee but with high fee child */
+    /* tx6 -> tx7 -> tx8, tx9 -> tx10 */
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vout.resize(1);
+    tx6.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx6.vout[0].nValue = 20 * COIN;
+    pool.addUnchecked(tx6.GetHash(), CTxMemPoolEntry(tx6, 0LL, 2, 1.0, 1, true));
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+    // Check that at this point, tx6 is sorted low
+    sortedOrder.insert(sortedOrder.begin(), tx6.GetHash().ToString());
+    CheckSort<descendant_score>(pool, sortedOrder);
+
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vin.resize(1);
+    tx7.vin[0].prevout = COutPoint(tx6.GetHash(), 0);
+    tx7.vin[0].scriptSig = CScript() << OP_11;
+    tx7.vout.resize(2);
+    tx7.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx7.vout[0].nValue = 10 * COIN;
+    tx7.vout[1].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx7.vout[1].nValue = 1 * COIN;
+
+    CTxMemPool::setEntries setAncestors;
+    setAncestors.insert(pool.mapTx.find(tx6.GetHash()));
+    CTxMemPool::setEntries setAncestorsCalculated;
+    std::string dummy;
+    CTxMemPoolEntry entry7(tx7, 2000000LL, 3, 1.0, 1, false);
+    BOOST_CHECK_EQUAL(pool.CalculateMemPoolAncestors(entry7, setAncestorsCalculated, 100, 1000000, 1000, 1000000, dummy), true);
+    BOOST_CHECK(setAncestorsCalculated == setAncestors);
+
+    pool.addUnchecked(tx7.GetHash(), entry7, setAncestors);
+    BOOST_CHECK_EQUAL(pool.size(), 7);
+
+    // Now tx6 should be sorted higher (high fee child): tx7, tx6, tx2, ...
+    sortedOrder.erase(sortedOrder.begin());
+    sortedOrder.push_back(tx6.GetHash().ToString());
+    sortedOrder.push_back(tx7.GetHash().ToString());
+    CheckSort<descendant_score>(pool, sortedOrder);
+
+    /* low fee child of tx7 */
+    CMutableTransaction tx8 = CMutableTransaction();
+    tx8.vin.resize(1);
+    tx8.vin[0].prevout = COutPoint(tx7.GetHash(), 0);
+    tx8.vin[0].scriptSig = CScript() << OP_11;
+    tx8.vout.resize(1);
+    tx8.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx8.vout[0].nValue = 10 * COIN;
+    setAncestors.insert(pool.mapTx.find(tx7.GetHash()));
+    pool.addUnchecked(tx8.GetHash(), CTxMemPoolEntry(tx8, 0LL, 2, 10.0, 1, false), setAncestors);
+
+    // Now tx8 should be sorted low, but tx6/tx both high
+    sortedOrder.insert(sortedOrder.begin(), tx8.GetHash().ToString());
+    CheckSort<descendant_score>(pool, sortedOrder);
+
+    /* low fee child of tx7 */
+    CMutableTransaction tx9 = CMutableTransaction();
+    tx9.vin.resize(1);
+    tx9.vin[0].prevout = COutPoint(tx7.GetHash(), 1);
+    tx9.vin[0].scriptSig = CScript() << OP_11;
+    tx9.vout.resize(1);
+    tx9.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx9.vout[0].nValue = 1 * COIN;
+    pool.addUnchecked(tx9.GetHash(), CTxMemPoolEntry(tx9, 0LL, 3, 10.0, 1, false), setAncestors);
+
+    // tx9 should be sorted low
+    BOOST_CHECK_EQUAL(pool.size(), 9);
+    sortedOrder.insert(sortedOrder.begin(), tx9.GetHash().ToString());
+    CheckSort<descendant_score>(pool, sortedOrder);
+
+    std::vector<std::string> snapshotOrder = sortedOrder;
+
+    setAncestors.insert(pool.mapTx.find(tx8.GetHash()));
+    setAncestors.insert(pool.mapTx.find(tx9.GetHash()));
+    /* tx10 depends on tx8 and tx9 and has a high fee*/
+    CMutableTransaction tx10 = CMutableTransaction();
+    tx10.vin.resize(2);
+    tx10.vin[0].prevout = COutPoint(tx8.GetHash(), 0);
+    tx10.vin[0].scriptSig = CScript() << OP_11;
+    tx10.vin[1].prevout = COutPoint(tx9.GetHash(), 0);
+    tx10.vin[1].scriptSig = CScript() << OP_11;
+    tx10.vout.resize(1);
+    tx10.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx10.vout[0].nValue = 10 * COIN;
+
+    setAncestorsCalculated.clear();
+    CTxMemPoolEntry entry10(tx10, 200000LL, 4, 10.0, 1, false);
+    BOOST_CHECK_EQUAL(pool.CalculateMemPoolAncestors(entry10, setAncestorsCalculated, 100, 1000000, 1000, 1000000, dummy), true);
+    BOOST_CHECK(setAncestorsCalculated == setAncestors);
+
+    pool.addUnchecked(tx10.GetHash(), entry10, setAncestors);
+
+    /**
+     *  tx8 and tx9 should both now be sorted higher
+     *  Final order after tx10 is added:
+     *
+     *  tx3 = 0 (1)
+     *  tx5 = 10000 (1)
+     *  tx1 = 10000 (1)
+     *  tx4 = 15000 (1)
+     *  tx2 = 20000 (1)
+     *  tx9 = 200k (2 txs)
+     *  tx8 = 200k (2 txs)
+     *  tx10 = 200k (1 tx)
+     *  tx6 = 2.2M (5 txs)
+     *  tx7 = 2.2M (4 txs)
+     */
+    sortedOrder.erase(sortedOrder.begin(), sortedOrder.begin()+2); // take out tx9, tx8 from the beginning
+    sortedOrder.insert(sortedOrder.begin()+5, tx9.GetHash().ToString());
+    sortedOrder.insert(sortedOrder.begin()+6, tx8.GetHash().ToString());
+    sortedOrder.insert(sortedOrder.begin()+7, tx10.GetHash().ToString()); // tx10 is just before tx6
+    CheckSort<descendant_score>(pool, sortedOrder);
+
+    // there should be 10 transactions in the mempool
+    BOOST_CHECK_EQUAL(pool.size(), 10);
+
+    // Now try removing tx10 and verify the sort order returns to normal
+    std::list<CTransaction> removed;
+    pool.remove(pool.mapTx.find(tx10.GetHash())->GetTx(), removed, true);
+    CheckSort<descendant_score>(pool, snapshotOrder);
+
+    pool.remove(pool.mapTx.find(tx9.GetHash())->GetTx(), removed, true);
+    pool.remove(pool.mapTx.find(tx8.GetHash())->GetTx(), removed, true);
+
+    /* Now check the sort on the mining score index.
+     * Final order should be:
+     *
+     * tx7 (2M)
+     * tx2 (20k)
+     * tx4 (15000)
+     * tx1/tx5 (10000)
+     * tx3/6 (0)
+     * (Ties resolved by hash)
+     */
+    sortedOrder.clear();
+    sortedOrder.push_back(tx7.GetHash().ToString());
+    sortedOrder.push_back(tx2.GetHash().ToString());
+    sortedOrder.push_back(tx4.GetHash().ToString());
+    if (tx1.GetHash() < tx5.GetHash()) {
+        sortedOrder.push_back(tx5.GetHash().ToString());
+        sortedOrder.push_back(tx1.GetHash().ToString());
+    } else {
+        sortedOrder.push_back(tx1.GetHash().ToString());
+        sortedOrder.push_back(tx5.GetHash().ToString());
+    }
+    if (tx3.GetHash() < tx6.GetHash()) {
+        sortedOrder.push_back(tx6.GetHash().ToString());
+        sortedOrder.push_back(tx3.GetHash().ToString());
+    } else {
+        sortedOrder.push_back(tx3.GetHash().ToString());
+        sortedOrder.push_back(tx6.GetHash().ToString());
+    }
+    CheckSort<mining_score>(pool, sortedOrder);
+
+    // Entry time order
+    sortedOrder.clear();
+    CTxMemPool::indexed_transaction_set::index<entry_time>::type::iterator tit = pool.mapTx.get<entry_time>().begin();
+    int64_t nLastTime = 0;
+    for (; tit != pool.mapTx.get<entry_time>().end(); ++tit) {
+        BOOST_CHECK(tit->GetTime() >= nLastTime);
+        nLastTime = tit->GetTime();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    /* 3rd highest fee */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 0, 10.0, 1, true));
+
+    /* highest fee */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 20000LL, 0, 9.0, 1, true));
+    uint64_t tx2Size = ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* lowest fee */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0LL, 0, 100.0, 1, true));
+
+    /* 2nd highest fee */
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx4.vout[0].nValue = 6 * COIN;
+    pool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 15000LL, 0, 1.0, 1, true));
+
+    /* equal fee rate to tx1, but newer */
+    CMutableTransaction tx5 = CMutableTransaction();
+    tx5.vout.resize(1);
+    tx5.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx5.vout[0].nValue = 11 * COIN;
+    pool.addUnchecked(tx5.GetHash(), CTxMemPoolEntry(tx5, 10000LL, 0, 1.0, 1, true));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.resize(5);
+    sortedOrder[0] = tx2.GetHash().ToString(); // 20000
+    sortedOrder[1] = tx4.GetHash().ToString(); // 15000
+    // tx1 and tx5 are both 10000
+    // Ties are broken by hash, not timestamp, so determine which
+    // hash comes first.
+    if (tx1.GetHash() < tx5.GetHash()) {
+        sortedOrder[2] = tx1.GetHash().ToString();
+        sortedOrder[3] = tx5.GetHash().ToString();
+    } else {
+        sortedOrder[2] = tx5.GetHash().ToString();
+        sortedOrder[3] = tx1.GetHash().ToString();
+    }
+    sortedOrder[4] = tx3.GetHash().ToString(); // 0
+
+    CheckSort<ancestor_score>(pool, sortedOrder);
+
+    /* low fee parent with high fee child */
+    /* tx6 (0) -> tx7 (high) */
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vout.resize(1);
+    tx6.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx6.vout[0].nValue = 20 * COIN;
+    uint64_t tx6Size = ::GetSerializeSize(tx6, SER_NETWORK, PROTOCOL_VERSION);
+
+    pool.addUnchecked(tx6.GetHash(), CTxMemPoolEntry(tx6, 0LL, 0, 1.0, 1, true));
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.push_back(tx6.GetHash().ToString());
+    else
+        sortedOrder.insert(sortedOrder.end()-1, tx6.GetHash().ToString());
+
+    CheckSort<ancestor_score>(pool, sortedOrder);
+
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vin.resize(1);
+    tx7.vin[0].prevout = COutPoint(tx6.GetHash(), 0);
+    tx7.vin[0].scriptSig = CScript() << OP_11;
+    tx7.vout.resize(1);
+    tx7.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx7.vout[0].nValue = 10 * COIN;
+    uint64_t tx7Size = ::GetSerializeSize(tx7, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* set the fee to just below tx2's feerate when including ancestor */
+    CAmount fee = (20000/tx2Size)*(tx7Size + tx6Size) - 1;
+
+    pool.addUnchecked(tx7.GetHash(), CTxMemPoolEntry(tx7, fee, 0, 1.0, 1, false));
+    BOOST_CHECK_EQUAL(pool.size(), 7);
+    sortedOrder.insert(sortedOrder.begin()+1, tx7.GetHash().ToString());
+    CheckSort<ancestor_score>(pool, sortedOrder);
+
+    /* after tx6 is mined, tx7 should move up in the sort */
+    std::vector<CTransaction> vtx;
+    vtx.push_back(tx6);
+    std::list<CTransaction> dummy;
+    pool.removeForBlock(vtx, 1, dummy, false);
+
+    sortedOrder.erase(sortedOrder.begin()+1);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.pop_back();
+    else
+        sortedOrder.erase(sortedOrder.end()-2);
+    sortedOrder.insert(sortedOrder.begin(), tx7.GetHash().ToString());
+    CheckSort<ancestor_score>(pool, sortedOrder);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPackageStateTest)
+{
+    // Ancestor and descendant statistics are kept up to date as a chain
+    // is added, prioritised and removed again.
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++)
+    {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout = COutPoint(txParent.GetHash(), i);
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txGrandChild.vin[i].scriptSig = CScript() << OP_11;
+        txGrandChild.vin[i].prevout = COutPoint(txChild[i].GetHash(), 0);
+    }
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 11000LL;
+
+    uint64_t nParentSize = ::GetSerializeSize(txParent, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nChildSize = ::GetSerializeSize(txChild[0], SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nGrandChildSize = ::GetSerializeSize(txGrandChild, SER_NETWORK, PROTOCOL_VERSION);
+
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000LL, 0, 0.0, 1, true, 1));
+    for (int i = 0; i < 2; i++)
+        pool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 2000LL, 0, 0.0, 1, false, 2));
+    pool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 3000LL, 0, 0.0, 1, false, 3));
+
+    CTxMemPool::txiter parentIt = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter childIt = pool.mapTx.find(txChild[0].GetHash());
+    CTxMemPool::txiter grandChildIt = pool.mapTx.find(txGrandChild.GetHash());
+
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(parentIt).size(), 2);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(grandChildIt).size(), 2);
+
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(parentIt->GetSizeWithDescendants(), nParentSize + 2 * nChildSize + nGrandChildSize);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 8000);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetSizeWithAncestors(), nParentSize + nChildSize);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 4);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 8000);
+    BOOST_CHECK_EQUAL(grandChildIt->GetSigOpCountWithAncestors(), 8);
+
+    // Prioritising the parent shows up in both directions
+    pool.PrioritiseTransaction(txParent.GetHash(), txParent.GetHash().ToString(), 0.0, 500);
+    BOOST_CHECK_EQUAL(parentIt->GetModifiedFee(), 1500);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 8500);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 8500);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 3500);
+
+    // Mining the parent leaves the children as roots
+    std::vector<CTransaction> vtx;
+    vtx.push_back(txParent);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts, false);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(childIt).size(), 0);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(grandChildIt->GetSizeWithAncestors(), 2 * nChildSize + nGrandChildSize);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 7000);
+
+    // Removing one child takes the grandchild with it
+    std::list<CTransaction> removed;
+    pool.remove(txChild[1], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetSizeWithDescendants(), nChildSize);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(childIt).size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    SetMockTime(42);
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 0, 0.0, 1, true));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000LL, 0, 0.0, 1, true));
+
+    // Nothing is evicted while the pool fits
+    size_t nUsage = pool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > 0);
+    pool.TrimToSize(nUsage);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // The lowest fee rate transaction goes first
+    pool.TrimToSize(nUsage - 1);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+    BOOST_CHECK(pool.DynamicMemoryUsage() < nUsage);
+
+    // A high fee child lifts its parent's descendant score above tx2
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000LL, 0, 0.0, 1, true));
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_1;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 50000LL, 0, 0.0, 1, false));
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx3.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+
+    // Evicting a parent takes its descendants with it
+    pool.TrimToSize(1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    CFeeRate maxFeeRateRemoved(60000, ::GetSerializeSize(tx1, SER_NETWORK, PROTOCOL_VERSION) + ::GetSerializeSize(tx3, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), maxFeeRateRemoved.GetFeePerK() + 1000);
+
+    // The minimum fee only starts to decay once a block has been seen
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), maxFeeRateRemoved.GetFeePerK() + 1000);
+    pool.removeForBlock(vtx, 1, conflicts);
+    SetMockTime(42 + 2*CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), (maxFeeRateRemoved.GetFeePerK() + 1000)/2);
+
+    // ... and drops to zero once it gets close to the minimum relay fee
+    SetMockTime(42 + 20*CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPersistTest)
+{
+    LOCK2(cs_main, mempool.cs);
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+
+    // Outputs anybody can spend with a standard input
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    CScript scriptSig = CScript() << std::vector<unsigned char>(redeemScript.begin(), redeemScript.end());
+
+    CMutableTransaction txFunding;
+    txFunding.vin.resize(1);
+    txFunding.vin[0].prevout = COutPoint(uint256S("0x1"), 0);
+    txFunding.vout.resize(2);
+    for (unsigned int i = 0; i < 2; i++) {
+        txFunding.vout[i].scriptPubKey = scriptPubKey;
+        txFunding.vout[i].nValue = 10 * COIN;
+    }
+    AddCoins(*pcoinsTip, txFunding, 0);
+
+    // A parent, its child and an unrelated transaction, each entering at a different time
+    std::vector<CMutableTransaction> vtx(3);
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        vtx[i].vin.resize(1);
+        vtx[i].vin[0].scriptSig = scriptSig;
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].scriptPubKey = scriptPubKey;
+        vtx[i].vout[0].nValue = 10 * COIN - 20000;
+    }
+    vtx[0].vin[0].prevout = COutPoint(txFunding.GetHash(), 0);
+    vtx[1].vin[0].prevout = COutPoint(vtx[0].GetHash(), 0);
+    vtx[1].vout[0].nValue = vtx[0].vout[0].nValue - 20000;
+    vtx[2].vin[0].prevout = COutPoint(txFunding.GetHash(), 1);
+    std::map<uint256, int64_t> mapTimes;
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        SetMockTime(nTime + 10 * i);
+        CValidationState state;
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, vtx[i], false, NULL));
+        mapTimes[vtx[i].GetHash()] = nTime + 10 * i;
+    }
+
+    // Prioritisations are kept, also those of transactions not in the mempool
+    mempool.PrioritiseTransaction(vtx[2].GetHash(), vtx[2].GetHash().ToString(), 1.0, 5000);
+    mempool.PrioritiseTransaction(uint256S("0x2"), "0x2", 0.0, 1000);
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas = mempool.mapDeltas;
+    BOOST_CHECK_EQUAL(mapDeltas.size(), 2);
+
+    DumpMempool();
+    mempool.clear();
+    for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); it++)
+        mempool.ClearPrioritisation(it->first);
+    BOOST_CHECK(mempool.mapDeltas.empty());
+
+    SetMockTime(nTime + 100);
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), vtx.size());
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(vtx[i].GetHash());
+        BOOST_REQUIRE(it != mempool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->GetTime(), mapTimes[vtx[i].GetHash()]);
+    }
+    BOOST_CHECK(mempool.mapDeltas == mapDeltas);
+    BOOST_CHECK_EQUAL(mempool.mapTx.find(vtx[2].GetHash())->GetModifiedFee(), 25000);
+
+    mempool.clear();
+    for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); it++)
+        mempool.ClearPrioritisation(it->first);
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -268,4 +268,142 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+/** A transaction of the same size for every n, spending an output nothing provides. */
+static CTransaction TemplateTestTx(unsigned int n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = uint256S("0x1");
+    tx.vin[0].prevout.n = n;
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1000;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    return tx;
+}
+
+static bool TemplateHasTx(const CBlockAssembler& assembler, const CTransaction& tx)
+{
+    const std::vector<CTransaction>& vtx = assembler.GetTemplate().block.vtx;
+    for (size_t i = 1; i < vtx.size(); i++) {
+        if (vtx[i].GetHash() == tx.GetHash())
+            return true;
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(block_assembler_updates)
+{
+    LOCK2(cs_main, mempool.cs);
+    std::vector<CTransaction> vtx;
+    for (unsigned int i = 0; i < 5; i++)
+        vtx.push_back(TemplateTestTx(i));
+    const unsigned int nTxSize = ::GetSerializeSize(vtx[0], SER_NETWORK, PROTOCOL_VERSION);
+
+    // Room for exactly two of the transactions, all selected by fee rate.
+    mapArgs["-blockmaxsize"] = strprintf("%u", 1000 + 2 * nTxSize + 1);
+    mapArgs["-blockprioritysize"] = "0";
+    SetMockTime(GetTime());
+
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    CBlockAssembler assembler;
+    mempool.addUnchecked(vtx[0].GetHash(), CTxMemPoolEntry(vtx[0], 20000, GetTime(), 0.0, 1));
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK_EQUAL(assembler.GetBlockTx(), 1);
+    BOOST_CHECK(!assembler.IsValidated());
+    assembler.SetValidated();
+
+    // Without mempool changes the template is reused as it is.
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(assembler.IsValidated());
+
+    // A new transaction is appended to it while it fits.
+    mempool.addUnchecked(vtx[1].GetHash(), CTxMemPoolEntry(vtx[1], 20000, GetTime(), 0.0, 1));
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK_EQUAL(assembler.GetBlockTx(), 2);
+    BOOST_CHECK(TemplateHasTx(assembler, vtx[1]));
+    BOOST_CHECK(!assembler.IsValidated());
+    assembler.SetValidated();
+
+    // One paying less than everything in the block never causes a rebuild...
+    mempool.addUnchecked(vtx[2].GetHash(), CTxMemPoolEntry(vtx[2], 10000, GetTime(), 0.0, 1));
+    assembler.Update(pindexPrev, GetTime());
+    SetMockTime(GetTime() + BLOCK_TEMPLATE_REBUILD_INTERVAL);
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(assembler.IsValidated());
+    BOOST_CHECK(!TemplateHasTx(assembler, vtx[2]));
+
+    // ...but one paying more does, once the rebuild interval has passed.
+    mempool.addUnchecked(vtx[3].GetHash(), CTxMemPoolEntry(vtx[3], 30000, GetTime(), 0.0, 1));
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(assembler.IsValidated());
+    BOOST_CHECK(!TemplateHasTx(assembler, vtx[3]));
+    SetMockTime(GetTime() + BLOCK_TEMPLATE_REBUILD_INTERVAL);
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(!assembler.IsValidated());
+    BOOST_CHECK_EQUAL(assembler.GetBlockTx(), 2);
+    BOOST_CHECK(TemplateHasTx(assembler, vtx[3]));
+    assembler.SetValidated();
+
+    // Removing a transaction that is not in the block changes nothing.
+    std::list<CTransaction> removed;
+    mempool.remove(vtx[2], removed);
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(assembler.IsValidated());
+
+    // Removing one that is in the block rebuilds it.
+    mempool.remove(vtx[3], removed);
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(!assembler.IsValidated());
+    BOOST_CHECK(!TemplateHasTx(assembler, vtx[3]));
+    BOOST_CHECK(TemplateHasTx(assembler, vtx[0]));
+    BOOST_CHECK(TemplateHasTx(assembler, vtx[1]));
+    assembler.SetValidated();
+
+    // So does replacing one by a conflicting transaction.
+    CMutableTransaction txConflict(vtx[0]);
+    txConflict.vout[0].nValue = 999;
+    mempool.removeConflicts(txConflict, removed);
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(!assembler.IsValidated());
+    BOOST_CHECK_EQUAL(assembler.GetBlockTx(), 1);
+    BOOST_CHECK(!TemplateHasTx(assembler, vtx[0]));
+    assembler.SetValidated();
+
+    // And trimming the mempool down past one of its transactions.
+    mempool.addUnchecked(vtx[4].GetHash(), CTxMemPoolEntry(vtx[4], 5000, GetTime(), 0.0, 1));
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(TemplateHasTx(assembler, vtx[4]));
+    assembler.SetValidated();
+    mempool.TrimToSize(mempool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!mempool.exists(vtx[4].GetHash()));
+    assembler.Update(pindexPrev, GetTime());
+    BOOST_CHECK(!assembler.IsValidated());
+    BOOST_CHECK_EQUAL(assembler.GetBlockTx(), 1);
+    BOOST_CHECK(TemplateHasTx(assembler, vtx[1]));
+    assembler.SetValidated();
+
+    // A new tip starts over from scratch.
+    uint256 hashNext = uint256S("0x2");
+    CBlockIndex indexNext;
+    indexNext.phashBlock = &hashNext;
+    indexNext.pprev = pindexPrev;
+    indexNext.nHeight = pindexPrev->nHeight + 1;
+    assembler.Update(&indexNext, GetTime());
+    BOOST_CHECK(!assembler.IsValidated());
+    BOOST_CHECK_EQUAL(assembler.GetBlockTx(), 1);
+    assembler.SetValidated();
+
+    // After unsubscribing, the next update subscribes again and starts over.
+    assembler.Unsubscribe();
+    assembler.Update(&indexNext, GetTime());
+    BOOST_CHECK(!assembler.IsValidated());
+    BOOST_CHECK_EQUAL(assembler.GetBlockTx(), 1);
+
+    mempool.clear();
+    SetMockTime(0);
+    mapArgs.erase("-blockmaxsize");
+    mapArgs.erase("-blockprioritysize");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "merkleblock.h"
+#include "hash.h"
 #include "serialize.h"
 #include "streams.h"
 #include "uint256.h"
@@ -29,8 +30,55 @@ public:
     }
 };
 
+// The original pair-at-a-time merkle root computation, including the CVE-2012-2459 check.
+static uint256 ReferenceMerkleRoot(std::vector<uint256> vHashes, bool& fMutated)
+{
+    fMutated = false;
+    while (vHashes.size() > 1) {
+        std::vector<uint256> vParents;
+        for (size_t i = 0; i < vHashes.size(); i += 2) {
+            size_t i2 = std::min(i + 1, vHashes.size() - 1);
+            if (i2 == i + 1 && i2 + 1 == vHashes.size() && vHashes[i] == vHashes[i2])
+                fMutated = true;
+            vParents.push_back(Hash(vHashes[i].begin(), vHashes[i].end(), vHashes[i2].begin(), vHashes[i2].end()));
+        }
+        vHashes.swap(vParents);
+    }
+    return vHashes.empty() ? uint256() : vHashes[0];
+}
+
 BOOST_FIXTURE_TEST_SUITE(pmt_tests, BasicTestingSetup)
 
+BOOST_AUTO_TEST_CASE(pmt_batched_merkle_root)
+{
+    for (unsigned int nTx = 0; nTx < 40; nTx++) {
+        for (int nDup = 0; nDup < 3; nDup++) {
+            CBlock block;
+            for (unsigned int j = 0; j < nTx; j++) {
+                CMutableTransaction tx;
+                tx.nLockTime = j;
+                block.vtx.push_back(CTransaction(tx));
+            }
+            // Append copies of trailing transactions to trigger the mutation check.
+            if (nDup == 1 && nTx >= 1)
+                block.vtx.push_back(block.vtx.back());
+            if (nDup == 2 && nTx >= 2) {
+                block.vtx.push_back(block.vtx[nTx - 2]);
+                block.vtx.push_back(block.vtx[nTx - 1]);
+            }
+
+            std::vector<uint256> vTxid;
+            for (unsigned int j = 0; j < block.vtx.size(); j++)
+                vTxid.push_back(block.vtx[j].GetHash());
+            bool fMutated1, fMutated2;
+            uint256 root1 = block.BuildMerkleTree(&fMutated1);
+            uint256 root2 = ReferenceMerkleRoot(vTxid, fMutated2);
+            BOOST_CHECK(root1 == root2);
+            BOOST_CHECK_EQUAL(fMutated1, fMutated2);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(pmt_test1)
 {
     seed_insecure_rand(false);
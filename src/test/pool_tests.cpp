@@ -0,0 +1,125 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "memusage.h"
+#include "random.h"
+#include "support/allocators/pool.h"
+#include "test/test_bitcoin.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(basic_allocating)
+{
+    PoolResource<8, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+
+    // The first allocation takes a chunk; small sizes are rounded up to the alignment.
+    void* block = resource.Allocate(1, 1);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 8U);
+
+    // A freed block is handed out again for the next request of the same size.
+    resource.Deallocate(block, 1, 1);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+    void* b = resource.Allocate(8, 1);
+    BOOST_CHECK(b == block);
+
+    // Too large or too strictly aligned requests bypass the pool.
+    void* large = resource.Allocate(16, 1);
+    void* aligned = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 8U + 16U + 8U);
+    BOOST_CHECK_EQUAL(resource.BytesAllocated(), 1024U + 16U + 8U);
+    resource.Deallocate(large, 16, 1);
+    resource.Deallocate(aligned, 8, 16);
+    resource.Deallocate(b, 8, 1);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+    BOOST_CHECK_EQUAL(resource.BytesAllocated(), 1024U);
+
+    // Filling the chunk takes a new one.
+    std::vector<void*> blocks;
+    for (size_t i = 0; i < 1024 / 8 + 1; i++)
+        blocks.push_back(resource.Allocate(8, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    for (size_t i = 0; i < blocks.size(); i++)
+        resource.Deallocate(blocks[i], 8, 8);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+}
+
+// The rest of a chunk that cannot hold a request is kept for smaller ones.
+BOOST_AUTO_TEST_CASE(remainder_of_chunk_is_reused)
+{
+    PoolResource<16, 8> resource(24);
+    void* a = resource.Allocate(16, 8);
+    void* b = resource.Allocate(16, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    // The 8 bytes left over from the first chunk serve this one.
+    void* c = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    BOOST_CHECK(static_cast<char*>(c) == static_cast<char*>(a) + 16);
+    resource.Deallocate(a, 16, 8);
+    resource.Deallocate(b, 16, 8);
+    resource.Deallocate(c, 8, 8);
+}
+
+// Once nothing is in use, all chunks can be given back, and the pool starts over.
+BOOST_AUTO_TEST_CASE(release_chunks)
+{
+    PoolResource<8, 8> resource(64);
+    std::vector<void*> blocks;
+    for (size_t i = 0; i < 20; i++)
+        blocks.push_back(resource.Allocate(8, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 3U);
+    for (size_t i = 0; i < blocks.size(); i++)
+        resource.Deallocate(blocks[i], 8, 8);
+    resource.Release();
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+    BOOST_CHECK_EQUAL(resource.BytesAllocated(), 0U);
+
+    void* block = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 8U);
+    resource.Deallocate(block, 8, 8);
+}
+
+// Randomly fill and empty a pool allocated map next to a reference map.
+BOOST_AUTO_TEST_CASE(random_map_operations)
+{
+    typedef std::pair<const uint64_t, uint64_t> Value;
+    typedef PoolAllocator<Value, sizeof(Value) + sizeof(void*) * 4> Allocator;
+    typedef boost::unordered_map<uint64_t, uint64_t, boost::hash<uint64_t>, std::equal_to<uint64_t>, Allocator> Map;
+
+    Allocator::ResourceType resource(4096);
+    std::map<uint64_t, uint64_t> reference;
+    {
+        Map map(0, boost::hash<uint64_t>(), std::equal_to<uint64_t>(), Allocator(&resource));
+        for (int i = 0; i < 20000; i++) {
+            uint64_t key = insecure_rand() % 2000;
+            if (insecure_rand() % 3 == 0) {
+                BOOST_CHECK_EQUAL(map.erase(key), reference.erase(key));
+            } else {
+                uint64_t value = insecure_rand();
+                map[key] = value;
+                reference[key] = value;
+            }
+        }
+        BOOST_CHECK_EQUAL(map.size(), reference.size());
+        for (std::map<uint64_t, uint64_t>::const_iterator it = reference.begin(); it != reference.end(); it++) {
+            Map::const_iterator found = map.find(it->first);
+            BOOST_CHECK(found != map.end() && found->second == it->second);
+        }
+        BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), resource.BytesInUse());
+        BOOST_CHECK(resource.BytesInUse() <= resource.BytesAllocated());
+    }
+    // Destroying the map returned everything to the resource.
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -13,6 +13,7 @@
 #include "script/script_error.h"
 #include "script/sign.h"
 #include "util.h"
+#include "test/sigchecker_openssl.h"
 #include "test/test_bitcoin.h"
 
 #if defined(HAVE_CONSENSUS_LIB)
@@ -96,6 +97,8 @@ void DoTest(const CScript& scriptPubKey, const CScript& scriptSig, int flags, bo
     CMutableTransaction tx2 = tx;
     BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0), &err) == expect, message);
     BOOST_CHECK_MESSAGE(expect == (err == SCRIPT_ERR_OK), std::string(ScriptErrorString(err)) + ": " + message);
+    // Every signature evaluated must get the same verdict from OpenSSL.
+    VerifyScript(scriptSig, scriptPubKey, flags, OpenSSLComparingSignatureChecker(CTransaction(tx), 0));
 #if defined(HAVE_CONSENSUS_LIB)
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << tx2;
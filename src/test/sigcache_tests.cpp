@@ -0,0 +1,82 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "util.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sigcache_store_and_stats)
+{
+    mapArgs["-maxsigcachesize"] = "1";
+    InitSignatureCache();
+
+    CSignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nBytes, 1U << 20);
+    BOOST_CHECK_EQUAL(stats.nCapacity, (1U << 20) / 32);
+    BOOST_CHECK_EQUAL(stats.nEntries, 0U);
+    // Hit and miss counts are kept for the lifetime of the process.
+    uint64_t nHits = stats.nHits, nMisses = stats.nMisses;
+
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CTransaction tx;
+    CachingTransactionSignatureChecker checker(&tx, 0, true);
+    CachingTransactionSignatureChecker checkerNoStore(&tx, 0, false);
+
+    std::vector<uint256> vHashes;
+    std::vector<std::vector<unsigned char> > vSigs;
+    for (int i = 0; i < 20; i++) {
+        vHashes.push_back(GetRandHash());
+        vSigs.push_back(std::vector<unsigned char>());
+        BOOST_CHECK(key.Sign(vHashes.back(), vSigs.back()));
+    }
+
+    // Only valid signatures verified with storing enabled are cached.
+    for (int i = 0; i < 20; i++) {
+        if (i % 2)
+            BOOST_CHECK(checker.VerifySignature(vSigs[i], pubkey, vHashes[i]));
+        else
+            BOOST_CHECK(checkerNoStore.VerifySignature(vSigs[i], pubkey, vHashes[i]));
+        BOOST_CHECK(!checker.VerifySignature(vSigs[i], pubkey, GetRandHash()));
+    }
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 10U);
+    BOOST_CHECK_EQUAL(stats.nHits - nHits, 0U);
+    BOOST_CHECK_EQUAL(stats.nMisses - nMisses, 20U + 20U);
+
+    // Verifying them again is answered from the cache for the stored ones.
+    for (int i = 0; i < 20; i++) {
+        nHits = stats.nHits;
+        BOOST_CHECK(checkerNoStore.VerifySignature(vSigs[i], pubkey, vHashes[i]));
+        GetSignatureCacheStats(stats);
+        BOOST_CHECK_EQUAL(stats.nHits - nHits, i % 2 == 1 ? 1U : 0U);
+    }
+    BOOST_CHECK_EQUAL(stats.nEntries, 10U);
+
+    // A cache of size zero never stores anything.
+    mapArgs["-maxsigcachesize"] = "0";
+    InitSignatureCache();
+    nHits = stats.nHits;
+    BOOST_CHECK(checker.VerifySignature(vSigs[1], pubkey, vHashes[1]));
+    BOOST_CHECK(checker.VerifySignature(vSigs[1], pubkey, vHashes[1]));
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, nHits);
+    BOOST_CHECK_EQUAL(stats.nCapacity, 0U);
+    mapArgs.erase("-maxsigcachesize");
+    // Restore the default-sized cache for the tests that follow.
+    InitSignatureCache();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,61 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEST_SIGCHECKER_OPENSSL_H
+#define BITCOIN_TEST_SIGCHECKER_OPENSSL_H
+
+#include "ecwrapper.h"
+#include "pubkey.h"
+#include "script/interpreter.h"
+#include "utilstrencodings.h"
+
+#include <openssl/ecdsa.h>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+ * Signature checker that verifies every signature both through CPubKey
+ * (libsecp256k1) and through the old OpenSSL CECKey path, and fails the
+ * current test case if the two disagree. The libsecp256k1 result is the one
+ * returned to the script interpreter.
+ *
+ * OpenSSL 1.0.0p and later refuse to parse some of the non-DER encodings
+ * (such as excess padding of R or S) that the test vectors still exercise
+ * without DERSIG; verdicts are only compared for signatures OpenSSL parses.
+ */
+class OpenSSLComparingSignatureChecker : public TransactionSignatureChecker
+{
+private:
+    const CTransaction txTo;
+
+protected:
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+    {
+        bool fSecp = TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash);
+        if (!OpenSSLParses(vchSig))
+            return fSecp;
+        CECKey key;
+        bool fOpenSSL = key.SetPubKey(pubkey.begin(), pubkey.size()) && key.Verify(sighash, vchSig);
+        BOOST_CHECK_MESSAGE(fSecp == fOpenSSL, "secp256k1 (" << fSecp << ") and OpenSSL (" << fOpenSSL << ") disagree on sig " <<
+                            HexStr(vchSig) << " pubkey " << HexStr(pubkey.begin(), pubkey.end()) << " hash " << sighash.GetHex());
+        return fSecp;
+    }
+
+    static bool OpenSSLParses(const std::vector<unsigned char>& vchSig)
+    {
+        if (vchSig.empty())
+            return false;
+        const unsigned char* sigptr = &vchSig[0];
+        ECDSA_SIG* sig = d2i_ECDSA_SIG(NULL, &sigptr, vchSig.size());
+        if (sig == NULL)
+            return false;
+        ECDSA_SIG_free(sig);
+        return true;
+    }
+
+public:
+    OpenSSLComparingSignatureChecker(const CTransaction& txToIn, unsigned int nInIn) : TransactionSignatureChecker(&txTo, nInIn), txTo(txToIn) {}
+};
+
+#endif // BITCOIN_TEST_SIGCHECKER_OPENSSL_H
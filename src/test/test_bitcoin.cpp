@@ -6,6 +6,8 @@
 
 #include "test_bitcoin.h"
 
+#include "crypto/hashskein.h"
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "random.h"
@@ -30,6 +32,8 @@ extern void noui_connect();
 BasicTestingSetup::BasicTestingSetup()
 {
         ECC_Start();
+        SHA256AutoDetect();
+        SkeinAutoDetect();
         SetupEnvironment();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
@@ -59,6 +63,7 @@ TestingSetup::TestingSetup()
         pwalletMain->LoadWallet(fFirstRun);
         RegisterValidationInterface(pwalletMain);
 #endif
+        InitSignatureCache();
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
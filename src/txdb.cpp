@@ -7,9 +7,12 @@
 
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <stdint.h>
 
@@ -17,6 +20,7 @@
 
 using namespace std;
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
@@ -28,11 +32,31 @@ static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
-    if (coins.IsPruned())
-        batch.Erase(make_pair(DB_COINS, hash));
+namespace {
+
+/** Database key of a coin: DB_COIN, the txid, and the output index as a VARINT. */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+}
+
+void static BatchWriteCoin(CLevelDBBatch &batch, const COutPoint &outpoint, const Coin &coin) {
+    if (coin.IsSpent())
+        batch.Erase(CoinEntry(&outpoint));
     else
-        batch.Write(make_pair(DB_COINS, hash), coins);
+        batch.Write(CoinEntry(&outpoint), coin);
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
@@ -42,12 +66,12 @@ void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -57,23 +81,27 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            BatchWriteCoin(batch, it->first, it->second.coin);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            it++;
+        }
     }
     if (!hashBlock.IsNull())
         BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
@@ -107,10 +135,14 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
     pcursor->SeekToFirst();
 
+    // Coins are keyed by txid first, so the outputs of a transaction are
+    // visited together; hash them as one per-transaction record.
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    uint256 prevhash;
+    bool fInTx = false;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -118,41 +150,116 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == DB_COINS) {
+            if (chType == DB_COIN) {
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+                Coin coin;
+                ssValue >> coin;
+                COutPoint outpoint;
+                ssKey >> outpoint.hash >> VARINT(outpoint.n);
+                if (!fInTx || outpoint.hash != prevhash) {
+                    if (fInTx)
+                        ss << VARINT(0);
+                    ss << outpoint.hash;
+                    ss << VARINT(coin.nVersion);
+                    ss << (coin.fCoinBase ? 'c' : 'n');
+                    ss << VARINT(coin.nHeight);
+                    stats.nTransactions++;
+                    prevhash = outpoint.hash;
+                    fInTx = true;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                stats.nTransactionOutputs++;
+                ss << VARINT(outpoint.n+1);
+                ss << coin.out;
+                nTotalAmount += coin.out.nValue;
+                stats.nSerializedSize += slKey.size() + slValue.size();
             }
             pcursor->Next();
         } catch (const std::exception& e) {
             return error("%s: Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    if (fInTx)
+        ss << VARINT(0);
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
+/** Number of old per-transaction records converted per database batch during Upgrade(). */
+static const size_t UPGRADE_BATCH_RECORDS = 100000;
+
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_COINS, uint256());
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid() || pcursor->key().empty() || pcursor->key()[0] != DB_COINS)
+        return true;
+
+    LogPrintf("Upgrading UTXO database to per-output records...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    CLevelDBBatch batch;
+    size_t nRecords = 0, nBatchRecords = 0, nOutputs = 0;
+    int nReportDone = 0;
+    // Each batch both adds the new records and erases the old ones, so an
+    // interrupted upgrade simply resumes where it stopped on the next start.
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        ssKey >> chType;
+        if (chType != DB_COINS)
+            break;
+        uint256 txid;
+        ssKey >> txid;
+        if (nRecords % 256 == 0) {
+            // Keys are ordered by the first serialized bytes of the txid.
+            int nPercentageDone = (int)((0x100 * txid.begin()[0] + txid.begin()[1]) * 100.0 / 65536.0 + 0.5);
+            uiInterface.ShowProgress(_("Upgrading UTXO database"), nPercentageDone);
+            if (nReportDone < nPercentageDone / 10) {
+                LogPrintf("[%d%%]...", nPercentageDone);
+                nReportDone = nPercentageDone / 10;
+            }
+        }
+
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        CCoins coins;
+        try {
+            ssValue >> coins;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+        for (size_t i = 0; i < coins.vout.size(); i++) {
+            if (!coins.vout[i].IsNull() && !coins.vout[i].scriptPubKey.IsUnspendable()) {
+                COutPoint outpoint(txid, i);
+                batch.Write(CoinEntry(&outpoint), Coin(coins.vout[i], coins.nHeight, coins.fCoinBase, coins.nVersion));
+                nOutputs++;
+            }
+        }
+        batch.Erase(make_pair(DB_COINS, txid));
+        nRecords++;
+        if (++nBatchRecords >= UPGRADE_BATCH_RECORDS) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch = CLevelDBBatch();
+            nBatchRecords = 0;
+        }
+        pcursor->Next();
+    }
+    if (!db.WriteBatch(batch))
+        return false;
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s]. Converted %u transactions into %u outputs.\n", ShutdownRequested() ? "CANCELLED" : "DONE",
+              (unsigned int)nRecords, (unsigned int)nOutputs);
+    return !ShutdownRequested();
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CLevelDBBatch batch;
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {